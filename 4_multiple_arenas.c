@@ -93,8 +93,9 @@ uint32_t* find_collisions_for_entity(Arena *arena, Bvh *bvh, Entity *entities, u
 
 	*collisionsCountOut = collisionsCount;
 	
-	// we can call finish array
-	finish_array(arena, collisions, collisionsCount);
+	// we could call finish array, but since we still have the split arena we can join it back instead
+	// that way the parent also gets the pages the split arena committed
+	arena_join(arena, &collisionsArena);
 	return collisions;
 }
 
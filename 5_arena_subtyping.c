@@ -13,11 +13,15 @@ typedef struct uint32_t_arena {
 	uint32_t *data;
 	uint32_t count;
 	uint32_t cap;
+	char *committed;
 } uint32_t_arena;
 
 void push(uint32_t_arena *a, uint32_t el) {
 	assert(a->count < a->cap);
-	grow_mem((char*)(a->data + a->count), (char*)(a->data + (a->count + 1)));
+	char *next = (char*)(a->data + (a->count + 1));
+	if ((uintptr_t)next > (uintptr_t)a->committed) {
+		a->committed = grow_mem(a->committed, next, (char*)(a->data + a->cap));
+	}
 	a->data[a->count++] = el;
 	return;
 }
@@ -35,16 +39,15 @@ uint32_t_arena splitoff(Arena *parent, uint32_t cap) {
 	child.cap = cap;
 	char *end = (char*)(child.data + child.cap);
 
-	split_mem(parent->next, end);
-	parent->next = end;
+	child.committed = split_mem(parent, (char*)child.data, end);
 	return child;
 }
 
 uint32_t_arena finish(Arena *parent, uint32_t_arena *child) {
 	assert((uintptr_t)parent->start <= (uintptr_t)child->data);
 	assert((uintptr_t)child->data <= (uintptr_t)parent->next);
+	join_mem(parent, (char*)child->data, (char*)(child->data + child->count), child->committed, (char*)(child->data + child->cap));
 	child->cap = child->count;
-	parent->next = (char*)(child->data + child->count);
 	return *child;
 }
 
@@ -53,6 +56,7 @@ uint32_t get(uint32_t_arena a, uint32_t id) {
 }
 
 // the core idea is that anything can be an arena as long as it uses split_mem and grow_mem
+// and hands its committed pages back with join_mem when it is done
 
 uint32_t_arena query_aabb(Arena *arena, Bvh *bvh, AABB aabb) {
 	uint32_t_arena touched = splitoff(arena, bvh->leavesCount);
@@ -77,6 +81,8 @@ uint32_t_arena query_aabb(Arena *arena, Bvh *bvh, AABB aabb) {
 		}
 	}
 
+	// finishing the empty stack hands the pages it committed back to the arena
+	finish(arena, &stack);
 	return finish(arena, &touched);
 }
 
@@ -138,7 +144,7 @@ int main(void) {
 	// remaining are:
 	// 1. we need to pass an arena to functions
 	// -> create a mechanism to get an arena local to the thread or something
-	//    I leave this as an exercise to the reader
+	//    arenas.c has thread local scratch arenas for this (scratch_begin/scratch_end), 6_pointer_hiding.c uses them
 	// 2. we have to have code for each type, which we can generate, potentially via macros
 	//    but still then we have to use .data or get() and similar to access elements
 	// the second, which I personally dont think of as too big of a problem. 
@@ -8,6 +8,7 @@
 
 typedef struct HiddenArena {
 	char *next;
+	char *committed;
 	char *end;
 } HiddenArena;
 
@@ -22,7 +23,9 @@ void* push_hidden_arena(void *ptr, size_t size, size_t alignment) {
 	char *astart = (char*)align_forward((uintptr_t)prev, alignment);
 	char *next = astart + size;
 	assert((uintptr_t)next <= (uintptr_t)hidden->end);
-	grow_mem(prev, next);
+	if ((uintptr_t)next > (uintptr_t)hidden->committed) {
+		hidden->committed = grow_mem(hidden->committed, next, hidden->end);
+	}
 	hidden->next = next;
 	return (void*)astart;
 }
@@ -39,18 +42,22 @@ void* pop_hidden_arena(void *ptr, size_t size) {
 void* splitoff_hidden_arena(Arena *parent, size_t size, size_t alignment) {
 	char *ptr = (char*)align_forward((uintptr_t)parent->next + sizeof(HiddenArena), alignment);
 	HiddenArena *hidden = get_hidden_arena_from_pointer(ptr);
+
+	// the header is part of the split-off memory, so it has to be committed before we write it
+	char *committed = split_mem(parent, (char*)hidden, ptr + size);
+	if ((uintptr_t)ptr > (uintptr_t)committed) {
+		committed = grow_mem(committed, ptr, ptr + size);
+	}
+
 	hidden->next = ptr;
+	hidden->committed = committed;
 	hidden->end = ptr + size;
-
-	grow_mem(parent->next, ptr);
-	split_mem(parent->next, hidden->end);
-	parent->next = hidden->end;
 	return ptr;
 }
 
 void* finish_hidden_arena(Arena *parent, void *ptr) {
 	HiddenArena *hidden = get_hidden_arena_from_pointer(ptr);
-	parent->next = hidden->next;
+	join_mem(parent, (char*)hidden, hidden->next, hidden->committed, hidden->end);
 	return ptr;
 }
 
@@ -67,11 +74,16 @@ void* next_hidden_arena(void *ptr) {
 
 
 // just for fun we use a global arena for this
-Arena *arena;
+// it is thread local, so every thread can point it to its own arena and call these functions without locking
+_Thread_local Arena *arena;
 
 uint32_t* query_aabb(Bvh *bvh, AABB aabb) {
 	uint32_t *touched = splitoff(arena, bvh->leavesCount, uint32_t);
-	uint32_t *stack = splitoff(arena, bvh->nodeCount, uint32_t);
+
+	// the stack only lives during the traversal, so it goes into a scratch arena
+	// should this thread have pointed arena to a scratch arena, we get the other one
+	TempMark scratch = scratch_begin_avoiding(arena);
+	uint32_t *stack = splitoff(scratch.arena, bvh->nodeCount, uint32_t);
 
 	push(stack, bvh->root);
 
@@ -92,6 +104,9 @@ uint32_t* query_aabb(Bvh *bvh, AABB aabb) {
 		}
 	}
 
+	// finishing the empty stack hands the pages it committed back to the scratch arena
+	finish(scratch.arena, stack);
+	scratch_end(scratch);
 	return finish(arena, touched);
 }
 
@@ -1,9 +1,18 @@
 
+#if defined(_WIN32)
 #define WIN32_LEAN_AND_MEAN
 #define _CRT_SECURE_NO_WARNINGS
 #include <windows.h>
+#else
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <stdio.h>
+#endif
 #include <stdalign.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 
 #define KB(n) ((uint64_t)0x400 * (uint64_t)(n))
@@ -12,8 +21,10 @@
 
 #define PAGE_SIZE KB(4)
 #define COMMIT_SIZE (128 * KB(4))
+#define HUGE_PAGE_SIZE MB(2)
 
 // In this arena implementation memory is divided into COMMIT_SIZE large blocks
+// arenas backed by huge pages use HUGE_PAGE_SIZE large blocks instead
 
 uintptr_t align_backward(uintptr_t ptr, size_t alignment) {	
 	return ptr & ~(alignment-1);
@@ -27,91 +38,428 @@ uintptr_t amount_until(uintptr_t ptr, size_t alignment) {
 	return ((ptr + (alignment-1)) & ~(alignment-1)) - ptr;
 }
 
-// when the allocation straddles a COMMIT_SIZE large block, we need to allocate more pages
-void grow_mem(char *prev, char *next) {
-	uintptr_t prevBlockEnd = align_forward((uintptr_t)prev, COMMIT_SIZE);
-	uintptr_t nextBlockEnd = align_forward((uintptr_t)next, COMMIT_SIZE);
-	if (prevBlockEnd != nextBlockEnd) {
-		VirtualAlloc((void*)prevBlockEnd, nextBlockEnd - prevBlockEnd, MEM_COMMIT, PAGE_READWRITE);
+// the platform layer, everything below only talks to the os through these functions
+// reserve hands out address space without any backing memory
+// commit makes pages in a reserved range usable, decommit gives them back but keeps the address space
+// commit rounds outwards to whole pages, decommit rounds inwards so it never touches a page it was not given fully
+
+#if defined(_WIN32)
+
+void* os_reserve(size_t size) {
+	void *ptr = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_READWRITE);
+	assert(ptr != NULL);
+	return ptr;
+}
+
+void os_commit(void *ptr, size_t size) {
+	VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE);
+}
+
+void os_decommit(void *ptr, size_t size) {
+	uintptr_t from = align_forward((uintptr_t)ptr, PAGE_SIZE);
+	uintptr_t to = align_backward((uintptr_t)ptr + size, PAGE_SIZE);
+	if (from < to) {
+		VirtualFree((void*)from, to - from, MEM_DECOMMIT);
+	}
+}
+
+void os_release(void *ptr, size_t size) {
+	VirtualFree(ptr, 0, MEM_RELEASE);
+}
+
+// large pages on windows need SeLockMemoryPrivilege and have to be committed when reserving
+// so we dont support them and arenas asking for huge pages just get normal ones
+void* os_reserve_aligned(size_t size, size_t alignment) {
+	return os_reserve(size);
+}
+
+bool os_advise_huge_pages(void *ptr, size_t size) {
+	return false;
+}
+
+void* os_reserve_hugetlb(size_t size) {
+	return NULL;
+}
+
+void os_prefault(void *ptr, size_t size) {
+	for (uintptr_t page = (uintptr_t)ptr; page < (uintptr_t)ptr + size; page += PAGE_SIZE) {
+		*(volatile char*)page = 0;
 	}
 }
 
+void os_populate(void *ptr, size_t size) {
+	os_commit(ptr, size);
+	os_prefault(ptr, size);
+}
+
+#else
+
+// on linux we reserve with PROT_NONE and MAP_NORESERVE, so the reservation is not charged against the commit limit
+// committing is just making the pages accessible, they get backed on first touch
+void* os_reserve(size_t size) {
+	void *ptr = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	assert(ptr != MAP_FAILED);
+	return ptr;
+}
+
+void os_commit(void *ptr, size_t size) {
+	uintptr_t from = align_backward((uintptr_t)ptr, PAGE_SIZE);
+	uintptr_t to = align_forward((uintptr_t)ptr + size, PAGE_SIZE);
+	int result = mprotect((void*)from, to - from, PROT_READ | PROT_WRITE);
+	assert(result == 0);
+	(void)result;
+}
+
+// MADV_DONTNEED drops the backing pages, PROT_NONE makes touching them fault again like on windows
+void os_decommit(void *ptr, size_t size) {
+	uintptr_t from = align_forward((uintptr_t)ptr, PAGE_SIZE);
+	uintptr_t to = align_backward((uintptr_t)ptr + size, PAGE_SIZE);
+	if (from < to) {
+		madvise((void*)from, to - from, MADV_DONTNEED);
+		mprotect((void*)from, to - from, PROT_NONE);
+	}
+}
+
+void os_release(void *ptr, size_t size) {
+	munmap(ptr, size);
+}
+
+// reserves a bit more and trims both ends, so the reservation starts at a multiple of alignment
+void* os_reserve_aligned(size_t size, size_t alignment) {
+	char *raw = (char*)os_reserve(size + alignment);
+	char *aligned = (char*)align_forward((uintptr_t)raw, alignment);
+	if (aligned > raw) {
+		munmap(raw, aligned - raw);
+	}
+	if (aligned < raw + alignment) {
+		munmap(aligned + size, (raw + alignment) - aligned);
+	}
+	return aligned;
+}
+
+// transparent huge pages, the kernel backs every 2MB aligned range we commit fully with a single huge page
+// returns false when the kernel wont give us any
+bool os_advise_huge_pages(void *ptr, size_t size) {
+	if (madvise(ptr, size, MADV_HUGEPAGE) != 0) {
+		return false;
+	}
+
+	// madvise is also happy when thp is switched off entirely
+	// when we cant read the mode we dont know, then we trust madvise
+	char mode[64] = {0};
+	FILE *file = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+	if (file == NULL) {
+		return true;
+	}
+	size_t readCount = fread(mode, 1, sizeof(mode) - 1, file);
+	bool failed = ferror(file) != 0;
+	fclose(file);
+	if (readCount == 0 || failed) {
+		return true;
+	}
+	return strstr(mode, "[never]") == NULL;
+}
+
+// explicit huge pages from the hugetlbfs pool (vm.nr_hugepages)
+// the whole range is taken from the pool up front, so this fails unless the pool is large enough
+// mprotect only works on whole huge pages here, so these arenas are committed from the start
+void* os_reserve_hugetlb(size_t size) {
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	return (ptr == MAP_FAILED) ? NULL : ptr;
+}
+
+// faults in already committed pages
+// MADV_POPULATE_WRITE needs linux 5.14, on older kernels or headers we touch every page ourselves
+void os_prefault(void *ptr, size_t size) {
+#ifdef MADV_POPULATE_WRITE
+	if (madvise(ptr, size, MADV_POPULATE_WRITE) == 0) {
+		return;
+	}
+#endif
+	for (uintptr_t page = (uintptr_t)ptr; page < (uintptr_t)ptr + size; page += PAGE_SIZE) {
+		*(volatile char*)page = 0;
+	}
+}
+
+// maps committed and already faulted in pages over the start of a reservation
+void os_populate(void *ptr, size_t size) {
+	void *result = mmap(ptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE | MAP_POPULATE, -1, 0);
+	assert(result == ptr);
+	(void)result;
+}
+
+#endif
+
+// the committed pointer is a high-water mark; [next, committed) is always committed
+// so an allocation that stays below it is just a compare and a bump, no syscall
+// memory we split off belongs to the child, it may commit or decommit it as it likes
+// so we keep track of the range [splitFloor, splitCeil) in which split-off arenas may lie
+// everything else below next was committed by ourselves
+// what happens to committed pages above next when the arena shrinks
+// DECOMMIT_RETAIN keeps retain bytes above next, and never gives back what the last cycle (the time between two arena_clear) used,
+// so an arena that fills up to about the same size every frame doesnt decommit and recommit every frame
+// but a frame that spikes only costs memory until the next clear after it
+typedef enum DecommitPolicy {
+	DECOMMIT_NEVER,
+	DECOMMIT_ALWAYS,
+	DECOMMIT_RETAIN,
+} DecommitPolicy;
+
+typedef struct Arena {
+	char *start;
+	char *next;
+	char *committed;
+	char *end;
+	char *splitFloor;
+	char *splitCeil;
+
+	// COMMIT_SIZE, or HUGE_PAGE_SIZE for ARENA_HUGE_PAGES
+	size_t commitSize;
+	uint32_t flags;
+
+	DecommitPolicy decommitPolicy;
+	size_t retain;
+	// highest next in this and in the previous cycle
+	char *peak;
+	char *previousPeak;
+	// bytes given back to the os over the lifetime of the arena
+	uint64_t decommitted;
+} Arena;
+
+// commits everything from committed up to the end of the block that next lies in, but never past end
+// returns the new committed pointer
+char* grow_mem_blocks(char *committed, char *next, char *end, size_t blockSize) {
+	char *blockEnd = (char*)align_forward((uintptr_t)next, blockSize);
+	if ((uintptr_t)blockEnd > (uintptr_t)end) {
+		blockEnd = end;
+	}
+	os_commit(committed, blockEnd - committed);
+	return blockEnd;
+}
+
+char* grow_mem(char *committed, char *next, char *end) {
+	return grow_mem_blocks(committed, next, end, COMMIT_SIZE);
+}
+
 // when we split memory we have one of three choices
 // 1. make the start of the split arena be aligned to the next block;
 // -> cant neatly align split arrays
 // 2. make the end of the split arena be aligned to the next block
 // -> all arenas take up minimum COMMIT_SIZE
 // 3. have arbitrary sized arenas
-// -> arenas can potentially start in the middle of an uncommited block
-//    in which case need to commit the page the arena started in
+// -> arenas can potentially start in the middle of a commited block
+//    in which case the split arena takes over the commited part of its range
 // choice 3 is what we do, and for this case we have the split_mem function
-void split_mem(char *from, char *start) {
-	uintptr_t fromBlock = align_backward((uintptr_t)from, COMMIT_SIZE);
-	uintptr_t startBlock = align_backward((uintptr_t)start, COMMIT_SIZE);
-	if (fromBlock != startBlock) {
-		VirtualAlloc(start, amount_until((uintptr_t)start, COMMIT_SIZE), MEM_COMMIT, PAGE_READWRITE);
+// it hands [start, end) over to the child and returns the childs committed pointer
+// the memory between parent->next and start (alignment, headers) stays with the parent and gets committed
+char* split_mem(Arena *parent, char *start, char *end) {
+	assert((uintptr_t)parent->next <= (uintptr_t)start);
+	assert((uintptr_t)end <= (uintptr_t)parent->end);
+
+	if ((uintptr_t)start > (uintptr_t)parent->committed) {
+		parent->committed = grow_mem_blocks(parent->committed, start, parent->end, parent->commitSize);
+	}
+
+	char *childCommitted = parent->committed;
+	if ((uintptr_t)childCommitted > (uintptr_t)end) {
+		childCommitted = end;
+	}
+
+	// the child never touches the page end lies in, so whatever we had committed above end stays valid
+	if ((uintptr_t)start < (uintptr_t)parent->splitFloor) {
+		parent->splitFloor = start;
 	}
+	parent->splitCeil = end;
+	if ((uintptr_t)parent->committed < (uintptr_t)end) {
+		parent->committed = end;
+	}
+	parent->next = end;
+	return childCommitted;
 }
 
-typedef struct Arena {
-	char *start;
-	char *next;
-	char *end;
-} Arena;
+// the opposite of split_mem, the parent continues right after the used part of a child that was split off at [start, end)
+// next and committed are the childs, everything the parent split off after the child is gone
+void join_mem(Arena *parent, char *start, char *next, char *committed, char *end) {
+	assert((uintptr_t)parent->start <= (uintptr_t)start);
+	assert((uintptr_t)start <= (uintptr_t)next);
+	assert((uintptr_t)next <= (uintptr_t)committed);
+	assert((uintptr_t)committed <= (uintptr_t)end);
 
-Arena arena_create(size_t size) {
+	// when the child committed all of its memory and nothing above it was split off,
+	// the childs committed pages run right into our own
+	if ((uintptr_t)committed < (uintptr_t)end || (uintptr_t)parent->splitCeil > (uintptr_t)end) {
+		parent->committed = committed;
+	}
+	if ((uintptr_t)parent->next > (uintptr_t)parent->peak) {
+		parent->peak = parent->next;
+	}
+	parent->next = next;
+
+	if ((uintptr_t)parent->splitFloor >= (uintptr_t)start) {
+		parent->splitFloor = parent->end;
+		parent->splitCeil = parent->start;
+	}
+	else {
+		parent->splitCeil = start;
+	}
+}
+
+// ARENA_HUGE_PAGES asks for 2MB pages, first as transparent huge pages, then from the hugetlbfs pool
+// if neither is available the arena silently uses normal pages
+// ARENA_HUGETLB is set by arena_create_flags when the pages came from the pool
+#define ARENA_HUGE_PAGES 0x1
+#define ARENA_HUGETLB 0x2
+
+// populate commits and faults in that many bytes at the start of the arena right away (MAP_POPULATE)
+Arena arena_create_flags(size_t size, uint32_t flags, size_t populate) {
 	Arena arena;
-	arena.start = (char*)VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_READWRITE);	
+	arena.commitSize = COMMIT_SIZE;
+
+	if (flags & ARENA_HUGE_PAGES) {
+		size = align_forward(size, HUGE_PAGE_SIZE);
+		arena.commitSize = HUGE_PAGE_SIZE;
+		arena.start = (char*)os_reserve_aligned(size, HUGE_PAGE_SIZE);
+
+		if (!os_advise_huge_pages(arena.start, size)) {
+			char *hugetlb = (char*)os_reserve_hugetlb(size);
+			if (hugetlb) {
+				os_release(arena.start, size);
+				arena.start = hugetlb;
+				flags |= ARENA_HUGETLB;
+			}
+			else {
+				flags &= ~ARENA_HUGE_PAGES;
+				arena.commitSize = COMMIT_SIZE;
+			}
+		}
+	}
+	else {
+		arena.start = (char*)os_reserve(size);
+	}
+
+	arena.flags = flags;
 	arena.next = arena.start;
+	arena.committed = (flags & ARENA_HUGETLB) ? arena.start + size : arena.start;
 	arena.end = arena.start + size;
+	arena.splitFloor = arena.end;
+	arena.splitCeil = arena.start;
+	arena.decommitPolicy = DECOMMIT_NEVER;
+	arena.retain = 0;
+	arena.peak = arena.start;
+	arena.previousPeak = arena.start;
+	arena.decommitted = 0;
+
+	if (populate > 0) {
+		char *populated = (char*)align_forward((uintptr_t)arena.start + populate, arena.commitSize);
+		if ((uintptr_t)populated > (uintptr_t)arena.end) {
+			populated = arena.end;
+		}
 
-	split_mem(NULL, arena.start);
+		// a fresh mapping from MAP_POPULATE would lose the huge page advice, so those get committed and faulted in by hand
+		if (flags & ARENA_HUGE_PAGES) {
+			os_commit(arena.start, populated - arena.start);
+			os_prefault(arena.start, populated - arena.start);
+		}
+		else {
+			os_populate(arena.start, populated - arena.start);
+		}
+
+		if ((uintptr_t)populated > (uintptr_t)arena.committed) {
+			arena.committed = populated;
+		}
+	}
 	return arena;
 }
 
+Arena arena_create(size_t size) {
+	return arena_create_flags(size, 0, 0);
+}
+
+void arena_set_decommit_policy(Arena *arena, DecommitPolicy policy, size_t retain) {
+	arena->decommitPolicy = policy;
+	arena->retain = retain;
+}
+
 void* alloc_aligned(Arena *arena, size_t size, size_t alignment) {
-	char *prev = arena->next;
 	char *astart = (char*)align_forward((uintptr_t)arena->next, alignment);
 	char *next = astart + size;
 	assert((uintptr_t)next <= (uintptr_t)arena->end);
-	grow_mem(prev, next);
+	if ((uintptr_t)next > (uintptr_t)arena->committed) {
+		arena->committed = grow_mem_blocks(arena->committed, next, arena->end, arena->commitSize);
+	}
 	arena->next = next;
 	return (void*)astart;
 }
 
+// alloc_aligned for an arena that several threads allocate from at the same time
+// fetch-add cant align, but most pushes have the same size and alignment, so the result is usually aligned already
+// when it isnt, we throw that piece away and fetch again with room to align
+// committing is done by whoever runs past committed first; committing pages twice is harmless,
+// so every thread that needs more commits on its own and then moves committed forward with a CAS, it never moves backwards
+// only allocation is safe to do concurrently, shrinking, splitting and clearing still need all threads to be done
+void* alloc_aligned_atomic(Arena *arena, size_t size, size_t alignment) {
+	char *astart = __atomic_fetch_add(&arena->next, size, __ATOMIC_RELAXED);
+	if (amount_until((uintptr_t)astart, alignment) != 0) {
+		astart = __atomic_fetch_add(&arena->next, size + alignment - 1, __ATOMIC_RELAXED);
+		astart = (char*)align_forward((uintptr_t)astart, alignment);
+	}
+
+	char *next = astart + size;
+	assert((uintptr_t)next <= (uintptr_t)arena->end);
+
+	char *committed = __atomic_load_n(&arena->committed, __ATOMIC_ACQUIRE);
+	if ((uintptr_t)next > (uintptr_t)committed) {
+		char *grown = grow_mem_blocks(committed, next, arena->end, arena->commitSize);
+		while ((uintptr_t)committed < (uintptr_t)grown) {
+			if (__atomic_compare_exchange_n(&arena->committed, &committed, grown, true, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+				break;
+			}
+		}
+	}
+	return (void*)astart;
+}
+
 Arena split_arena_aligned(Arena *arena, size_t amount, size_t alignment) {
 	char *prev = arena->next;
 	prev = (char*)align_forward((uintptr_t)prev, alignment);
 	char *next = prev + amount;	
 
 	assert((uintptr_t)next <= (uintptr_t)arena->end);
-	split_mem(arena->next, next);
 	
 	Arena split = {
 		.start = prev,
 		.next = prev,
 		.end = next,
+		.splitFloor = next,
+		.splitCeil = prev,
+		.commitSize = arena->commitSize,
+		.flags = arena->flags,
+		.peak = prev,
+		.previousPeak = prev,
 	};
-	
-	arena->next = next;
+	split.committed = split_mem(arena, prev, next);
 	return split;
 }
 
 Arena split_arena(Arena *arena, size_t amount) {
-	char *prev = arena->next;
-	char *next = prev + amount;	
+	return split_arena_aligned(arena, amount, 1);
+}
 
-	assert((uintptr_t)next <= (uintptr_t)arena->end);
-	split_mem(prev, next);
-	
-	Arena split = {
-		.start = prev,
-		.next = prev,
-		.end = next,
-	};
-	
-	arena->next = next;
-	return split;
+// gives the used part of a split-off arena back to its parent, together with the pages it committed
+// like finish_array, but the parent doesnt have to commit those pages again
+// arenas the child split off itself now lie below the parents next, so their range becomes part of the parents split range,
+// otherwise a later shrink would take their pages for committed ones
+void arena_join(Arena *parent, Arena *child) {
+	join_mem(parent, child->start, child->next, child->committed, child->end);
+
+	if ((uintptr_t)child->splitFloor < (uintptr_t)child->splitCeil) {
+		if ((uintptr_t)child->splitFloor < (uintptr_t)parent->splitFloor) {
+			parent->splitFloor = child->splitFloor;
+		}
+		if ((uintptr_t)child->splitCeil > (uintptr_t)parent->splitCeil) {
+			parent->splitCeil = child->splitCeil;
+		}
+	}
 }
 
 
@@ -127,17 +475,74 @@ void * arena_begin_aligned(Arena *arena, size_t alignment) {
 
 #define begin_aligned(ARENA, TYPE) (TYPE*)arena_begin_aligned(ARENA, alignof(TYPE))
 
-#define alloc(ARENA, COUNT, TYPE) (TYPE*)alloc_aligned(ARENA, sizeof(TYPE) * COUNT, alignof(TYPE))
-#define zalloc(ARENA, COUNT, TYPE) (TYPE*)alloc_aligned_and_zero(ARENA, sizeof(TYPE) * COUNT, alignof(TYPE))
-#define split_type(ARENA, COUNT, TYPE) split_arena_aligned(ARENA, COUNT * sizeof(TYPE), alignof(TYPE))
-
+#define alloc(ARENA, COUNT, TYPE) (TYPE*)alloc_aligned(ARENA, sizeof(TYPE) * (COUNT), alignof(TYPE))
+#define zalloc(ARENA, COUNT, TYPE) (TYPE*)alloc_aligned_and_zero(ARENA, sizeof(TYPE) * (COUNT), alignof(TYPE))
+#define split_type(ARENA, COUNT, TYPE) split_arena_aligned(ARENA, (COUNT) * sizeof(TYPE), alignof(TYPE))
+#define alloc_atomic(ARENA, COUNT, TYPE) (TYPE*)alloc_aligned_atomic(ARENA, sizeof(TYPE) * (COUNT), alignof(TYPE))
 
-// decommit ommitted
 
-void arena_shrink_to_pointer(Arena *arena, void *ptr) {
+// shrinking keeps the committed pages, so refilling the arena doesnt need any syscalls
+// unless we shrink into memory that was split off, then we only keep what we know we committed ourselves
+void shrink_mem(Arena *arena, char *ptr) {
 	assert((uintptr_t)arena->start <= (uintptr_t)ptr);
 	assert((uintptr_t)ptr <= (uintptr_t)arena->end);
+
+	if ((uintptr_t)arena->next > (uintptr_t)arena->peak) {
+		arena->peak = arena->next;
+	}
+
+	if ((uintptr_t)ptr < (uintptr_t)arena->splitFloor) {
+		if ((uintptr_t)arena->splitFloor < (uintptr_t)arena->committed) {
+			arena->committed = arena->splitFloor;
+		}
+		arena->splitFloor = arena->end;
+		arena->splitCeil = arena->start;
+	}
+	else if ((uintptr_t)ptr < (uintptr_t)arena->splitCeil) {
+		arena->committed = ptr;
+		arena->splitCeil = ptr;
+	}
+	else if ((uintptr_t)ptr > (uintptr_t)arena->committed) {
+		arena->committed = grow_mem_blocks(arena->committed, ptr, arena->end, arena->commitSize);
+	}
+
 	arena->next = ptr;
+}
+
+// gives back whole blocks above keep, everything above next belongs to us so this is always safe
+// pages from the hugetlbfs pool stay with the arena
+void decommit_mem(Arena *arena, char *keep) {
+	if (arena->flags & ARENA_HUGETLB) {
+		return;
+	}
+	if ((uintptr_t)keep < (uintptr_t)arena->next) {
+		keep = arena->next;
+	}
+
+	uintptr_t from = align_forward((uintptr_t)keep, arena->commitSize);
+	uintptr_t to = align_backward((uintptr_t)arena->committed, PAGE_SIZE);
+	if (from < to) {
+		os_decommit((void*)from, to - from);
+		arena->decommitted += to - from;
+		arena->committed = (char*)from;
+	}
+}
+
+char* max_ptr(char *a, char *b) {
+	return ((uintptr_t)a > (uintptr_t)b) ? a : b;
+}
+
+void arena_shrink_to_pointer(Arena *arena, void *ptr) {
+	shrink_mem(arena, (char*)ptr);
+
+	if (arena->decommitPolicy == DECOMMIT_ALWAYS) {
+		decommit_mem(arena, arena->next);
+	}
+	else if (arena->decommitPolicy == DECOMMIT_RETAIN) {
+		// in the middle of a cycle we keep everything this or the last cycle used
+		char *keep = max_ptr(arena->next + arena->retain, max_ptr(arena->peak, arena->previousPeak));
+		decommit_mem(arena, keep);
+	}
 	return;
 }
 
@@ -145,24 +550,94 @@ void arena_shrink_to_pointer(Arena *arena, void *ptr) {
 #define arena_free(ARENA, PTR) arena_shrink_to_pointer(ARENA, PTR)
 
 void* arena_pop_size(Arena *arena, size_t popSize) {
-	// this wont work with decommiting
-	// in that case we have to use memcpy
+	// the caller still reads the popped memory, so popping never decommits
 	char *popped = arena->next - popSize;
 	assert((uintptr_t)arena->start <= (uintptr_t)popped);
-	arena->next = popped;
+	shrink_mem(arena, popped);
 	return popped;
 }
 
 #define arena_push_type(ARENA, TYPE) (TYPE*)alloc_aligned(ARENA, sizeof(TYPE), alignof(TYPE))
 #define arena_pop_type(ARENA, TYPE) (TYPE*)arena_pop_size(ARENA, sizeof(TYPE))
+#define arena_push_type_atomic(ARENA, TYPE) (TYPE*)alloc_aligned_atomic(ARENA, sizeof(TYPE), alignof(TYPE))
 
+// clearing ends a cycle
 void arena_clear(Arena *arena) {
-	arena->next = arena->start;
+	shrink_mem(arena, arena->start);
+
+	if (arena->decommitPolicy == DECOMMIT_ALWAYS) {
+		decommit_mem(arena, arena->start);
+	}
+	else if (arena->decommitPolicy == DECOMMIT_RETAIN) {
+		// only what the cycle that just ended used is kept, a spike from the cycle before is given back now
+		decommit_mem(arena, max_ptr(arena->start + arena->retain, arena->peak));
+	}
+
+	arena->previousPeak = arena->peak;
+	arena->peak = arena->start;
 	return;
 }
 
+// a TempMark remembers where an arena was, temp_end frees everything allocated since
+typedef struct TempMark {
+	Arena *arena;
+	char *next;
+} TempMark;
+
+TempMark temp_begin(Arena *arena) {
+	return (TempMark){ .arena = arena, .next = arena->next };
+}
+
+void temp_end(TempMark mark) {
+	arena_shrink_to_pointer(mark.arena, mark.next);
+}
+
+// scratch arenas, every thread gets its own so there is nothing to lock
+// they are reserved the first time a thread asks for one
+// if a function allocates its result in an arena that is itself a scratch arena, and then uses scratch memory internally,
+// both would end up in the same arena and scratch_end would free the result too.
+// thats why there are two, and scratch_begin_avoiding hands out the one the caller is not using
+#define SCRATCH_COUNT 2
+#define SCRATCH_SIZE GB(64)
+
+_Thread_local Arena scratchArenas[SCRATCH_COUNT];
+
+TempMark scratch_begin_avoiding(Arena *conflict) {
+	for (int i = 0; i < SCRATCH_COUNT; i++) {
+		Arena *scratch = scratchArenas + i;
+		if (scratch == conflict) {
+			continue;
+		}
+		if (scratch->start == NULL) {
+			*scratch = arena_create(SCRATCH_SIZE);
+		}
+		return temp_begin(scratch);
+	}
+
+	assert(0 && "no scratch arena left");
+	return (TempMark){0};
+}
+
+TempMark scratch_begin(void) {
+	return scratch_begin_avoiding(NULL);
+}
+
+void scratch_end(TempMark mark) {
+	temp_end(mark);
+}
+
+// threads that exit have to give their scratch arenas back, the os wont do it for us
+void scratch_release(void) {
+	for (int i = 0; i < SCRATCH_COUNT; i++) {
+		Arena *scratch = scratchArenas + i;
+		if (scratch->start != NULL) {
+			os_release(scratch->start, scratch->end - scratch->start);
+			*scratch = (Arena){0};
+		}
+	}
+}
+
 // NOTE;
-// it would also be a good idea to keep track of the commited region to decrease the use of VirtualAlloc
-// though then care must be taken when calling the "finish" set of functions, 
-// Potentially split off arenas wont necessarily have all their pages committed, so when calling finish, the committed region must also be reset
-// for brevity I have not included this here
+// the committed pointer only ever tracks one contiguous range, which is why splitting needs splitFloor and splitCeil
+// Potentially split off arenas wont necessarily have all their pages committed, so when shrinking into them the committed region is reset
+// if the split off arena is still at hand, use arena_join or join_mem instead, then its committed pages are kept
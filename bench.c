@@ -0,0 +1,26 @@
+// small helpers shared by the bench_ programs
+// the benchmarks take their sizes from the command line, so they can be run small while testing
+
+#if !defined(_WIN32)
+#include <time.h>
+#endif
+
+double bench_seconds(void) {
+#if defined(_WIN32)
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+uint32_t bench_arg(int argc, char **argv, int index, uint32_t fallback) {
+	if (index < argc) {
+		return (uint32_t)strtoul(argv[index], NULL, 10);
+	}
+	return fallback;
+}
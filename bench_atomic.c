@@ -0,0 +1,90 @@
+#pragma clang diagnostic ignored "-Wlanguage-extension-token"
+#pragma clang diagnostic ignored "-Wc++20-designator"
+#pragma clang diagnostic ignored "-Wc99-extensions"
+
+#include "arenas.c"
+#include "stuff.c"
+#include "bench.c"
+#include "threads.c"
+
+// pushes the same number of values with 1 to 64 threads
+// once into one shared arena with arena_push_type_atomic, once into one arena per thread with arena_push_type
+// the per-thread arenas never touch a shared cache line, the shared one puts every push through the same atomic
+
+// usage: bench_atomic [pushCount] [maxThreads]
+
+typedef struct PushJob {
+	Arena *arenas;
+	uint32_t pushesPerThread;
+	bool shared;
+} PushJob;
+
+void push_worker(void *data, uint32_t threadIndex) {
+	PushJob *job = (PushJob*)data;
+
+	if (job->shared) {
+		Arena *arena = job->arenas;
+		for (uint32_t i = 0; i < job->pushesPerThread; i++) {
+			*(arena_push_type_atomic(arena, uint32_t)) = i;
+		}
+	}
+	else {
+		Arena *arena = job->arenas + threadIndex;
+		for (uint32_t i = 0; i < job->pushesPerThread; i++) {
+			*(arena_push_type(arena, uint32_t)) = i;
+		}
+	}
+}
+
+// every thread pushed 0 .. pushesPerThread-1, so the sum tells us whether a push got lost or overwritten
+uint64_t sum_values(Arena *arena) {
+	uint64_t sum = 0;
+	for (uint32_t *value = (uint32_t*)arena->start; value < (uint32_t*)arena->next; value++) {
+		sum += *value;
+	}
+	return sum;
+}
+
+double run(bool shared, uint32_t threadCount, uint32_t pushesPerThread) {
+	uint32_t arenaCount = shared ? 1 : threadCount;
+	Arena arena = arena_create(GB(128));
+	Arena *arenas = alloc(&arena, arenaCount, Arena);
+	for (uint32_t i = 0; i < arenaCount; i++) {
+		arenas[i] = split_arena(&arena, GB(64) / arenaCount);
+	}
+
+	PushJob job = { .arenas = arenas, .pushesPerThread = pushesPerThread, .shared = shared };
+	double start = bench_seconds();
+	run_on_threads(threadCount, push_worker, &job);
+	double time = bench_seconds() - start;
+
+	uint64_t expected = (uint64_t)pushesPerThread * (pushesPerThread - 1) / 2 * threadCount;
+	uint64_t sum = 0;
+	for (uint32_t i = 0; i < arenaCount; i++) {
+		sum += sum_values(arenas + i);
+	}
+	assert(sum == expected);
+	(void)expected;
+
+	os_release(arena.start, arena.end - arena.start);
+	return time;
+}
+
+int main(int argc, char **argv) {
+	uint32_t pushCount = bench_arg(argc, argv, 1, 1 << 26);
+	uint32_t maxThreads = bench_arg(argc, argv, 2, 64);
+	if (maxThreads > MAX_THREADS) {
+		maxThreads = MAX_THREADS;
+	}
+
+	printf("%u pushes split between the threads, %u hardware threads\n", pushCount, hardware_thread_count());
+	for (uint32_t threadCount = 1; threadCount <= maxThreads; threadCount *= 2) {
+		uint32_t pushesPerThread = pushCount / threadCount;
+		double sharedTime = run(true, threadCount, pushesPerThread);
+		double ownTime = run(false, threadCount, pushesPerThread);
+		double pushes = (double)pushesPerThread * threadCount;
+
+		printf("%3u threads  shared atomic %8.3fs %7.1fM pushes/s  per-thread %8.3fs %7.1fM pushes/s\n",
+			threadCount, sharedTime, pushes / sharedTime * 1e-6, ownTime, pushes / ownTime * 1e-6);
+	}
+}
@@ -0,0 +1,124 @@
+#pragma clang diagnostic ignored "-Wlanguage-extension-token"
+#pragma clang diagnostic ignored "-Wc++20-designator"
+#pragma clang diagnostic ignored "-Wc99-extensions"
+
+#include "arenas.c"
+#include "stuff.c"
+#include "bench.c"
+#include "threads.c"
+#include "bvh_build.c"
+#include "bvh_lbvh.c"
+#include "bvh_batch.c"
+
+// one query per entity, like every tick does it, first one by one with bvh_query, then as a batch with bvh_query_batch,
+// once in entity order and once sorted along a morton curve so the queries of a packet are close to each other,
+// and bvh_query once more in morton order, to tell what the sorting saves from what the packets save
+// all of them have to return the very same array for every entity
+
+// usage: bench_batch [entityCount]
+
+typedef struct SortKey {
+	uint64_t key;
+	uint32_t index;
+} SortKey;
+
+int compare_sort_keys(const void *a, const void *b) {
+	uint64_t keyA = ((const SortKey*)a)->key;
+	uint64_t keyB = ((const SortKey*)b)->key;
+	return (keyA > keyB) - (keyA < keyB);
+}
+
+void check_same(uint32_t entityCount, uint32_t **touched, uint32_t *touchedCounts, uint32_t **expected, uint32_t *expectedCounts) {
+	for (uint32_t i = 0; i < entityCount; i++) {
+		assert(touchedCounts[i] == expectedCounts[i]);
+		assert(memcmp(touched[i], expected[i], touchedCounts[i] * sizeof(uint32_t)) == 0);
+	}
+}
+
+int main(int argc, char **argv) {
+	uint32_t entityCount = bench_arg(argc, argv, 1, 1 << 20);
+
+	Arena arena = arena_create(GB(1024));
+	printf("%u entities, one query each\n", entityCount);
+
+	srand(1);
+	Entity *entities = random_entities(&arena, entityCount, radius_for_density(entityCount));
+	AABB *aabbs = alloc(&arena, entityCount, AABB);
+	for (uint32_t i = 0; i < entityCount; i++) {
+		aabbs[i] = entities[i].ab;
+	}
+	Bvh bvh = build_bvh(&arena, aabbs, entityCount);
+
+	// one by one, every result copied into its own array so it has the same shape as the batch results
+	uint32_t **expected = alloc(&arena, entityCount, uint32_t*);
+	uint32_t *expectedCounts = alloc(&arena, entityCount, uint32_t);
+	uint32_t *touched = alloc(&arena, entityCount, uint32_t);
+	uint32_t *nodeStack = alloc(&arena, bvh.nodeCount, uint32_t);
+
+	double start = bench_seconds();
+	uint64_t touchedTotal = 0;
+	for (uint32_t i = 0; i < entityCount; i++) {
+		expectedCounts[i] = bvh_query(&bvh, aabbs[i], touched, nodeStack);
+		expected[i] = alloc(&arena, expectedCounts[i], uint32_t);
+		memcpy(expected[i], touched, expectedCounts[i] * sizeof(uint32_t));
+		touchedTotal += expectedCounts[i];
+	}
+	double singleTime = bench_seconds() - start;
+	printf("bvh_query               %8.3fs  %7.3fus/query  touched %llu\n", singleTime, singleTime * 1e6 / entityCount, (unsigned long long)touchedTotal);
+
+	uint32_t **results = alloc(&arena, entityCount, uint32_t*);
+	uint32_t *resultCounts = alloc(&arena, entityCount, uint32_t);
+
+	TempMark temp = temp_begin(&arena);
+	start = bench_seconds();
+	bvh_query_batch(&bvh, &arena, aabbs, entityCount, results, resultCounts);
+	double batchTime = bench_seconds() - start;
+	printf("batch, entity order     %8.3fs  %7.3fus/query  %5.2fx\n", batchTime, batchTime * 1e6 / entityCount, singleTime / batchTime);
+	check_same(entityCount, results, resultCounts, expected, expectedCounts);
+	temp_end(temp);
+
+	// sorting is part of the price, so it is timed as well
+	AABB bounds = aabb_empty();
+	for (uint32_t i = 0; i < entityCount; i++) {
+		bounds = aabb_merge(bounds, aabbs[i]);
+	}
+
+	start = bench_seconds();
+	SortKey *keys = alloc(&arena, entityCount, SortKey);
+	for (uint32_t i = 0; i < entityCount; i++) {
+		keys[i] = (SortKey){ morton_code(entities[i].position, bounds), i };
+	}
+	qsort(keys, entityCount, sizeof(SortKey), compare_sort_keys);
+
+	AABB *sortedQueries = alloc(&arena, entityCount, AABB);
+	for (uint32_t i = 0; i < entityCount; i++) {
+		sortedQueries[i] = aabbs[keys[i].index];
+	}
+	uint32_t **sortedResults = alloc(&arena, entityCount, uint32_t*);
+	uint32_t *sortedCounts = alloc(&arena, entityCount, uint32_t);
+	double sortTime = bench_seconds() - start;
+
+	// sorted queries are faster one by one as well, the tree nodes they need are still in the cache from the query before
+	temp = temp_begin(&arena);
+	start = bench_seconds();
+	for (uint32_t i = 0; i < entityCount; i++) {
+		sortedCounts[i] = bvh_query(&bvh, sortedQueries[i], touched, nodeStack);
+		sortedResults[i] = alloc(&arena, sortedCounts[i], uint32_t);
+		memcpy(sortedResults[i], touched, sortedCounts[i] * sizeof(uint32_t));
+	}
+	double sortedSingleTime = bench_seconds() - start;
+	printf("bvh_query, morton order %8.3fs  %7.3fus/query  %5.2fx\n", sortedSingleTime, sortedSingleTime * 1e6 / entityCount, singleTime / sortedSingleTime);
+	temp_end(temp);
+
+	start = bench_seconds();
+	bvh_query_batch(&bvh, &arena, sortedQueries, entityCount, sortedResults, sortedCounts);
+	double sortedTime = bench_seconds() - start;
+	printf("batch, morton order     %8.3fs  %7.3fus/query  %5.2fx  (+%.3fs sorting)\n",
+		sortedTime, sortedTime * 1e6 / entityCount, singleTime / sortedTime, sortTime);
+
+	for (uint32_t i = 0; i < entityCount; i++) {
+		results[keys[i].index] = sortedResults[i];
+		resultCounts[keys[i].index] = sortedCounts[i];
+	}
+	check_same(entityCount, results, resultCounts, expected, expectedCounts);
+}
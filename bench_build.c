@@ -0,0 +1,120 @@
+#pragma clang diagnostic ignored "-Wlanguage-extension-token"
+#pragma clang diagnostic ignored "-Wc++20-designator"
+#pragma clang diagnostic ignored "-Wc99-extensions"
+
+#include "arenas.c"
+#include "stuff.c"
+#include "bench.c"
+#include "threads.c"
+#include "bvh_build.c"
+#include "bvh_lbvh.c"
+
+// the same scene built with insert_node, build_bvh and build_lbvh, then the same queries on all of them
+// all trees hold the same leaves, so every query has to touch the same number of them
+// afterwards every tree is put in depth first order with bvh_reorder and queried again
+
+// usage: bench_build [entityCount] [queryCount] [skipIncremental] [threadCount]
+// insert_node gets slow for 10M entities, pass 1 as third argument to only time the bulk builders
+
+typedef struct QueryResult {
+	double time;
+	uint64_t touched;
+} QueryResult;
+
+QueryResult run_queries(Arena *arena, Bvh *bvh, Entity *entities, uint32_t entityCount, uint32_t queryCount) {
+	TempMark temp = temp_begin(arena);
+	uint32_t *touched = alloc(arena, bvh->leavesCount, uint32_t);
+	uint32_t *nodeStack = alloc(arena, bvh->nodeCount, uint32_t);
+
+	srand(2);
+	QueryResult result = {0};
+	double start = bench_seconds();
+	for (uint32_t i = 0; i < queryCount; i++) {
+		uint32_t id = (uint32_t)(((uint64_t)rand() * RAND_MAX + rand()) % entityCount);
+		result.touched += bvh_query(bvh, entities[id].ab, touched, nodeStack);
+	}
+	result.time = bench_seconds() - start;
+
+	temp_end(temp);
+	return result;
+}
+
+// the permutation has to send every node to the one that now holds its identifier
+void reorder_and_query(Arena *arena, const char *name, Bvh *bvh, Entity *entities, uint32_t entityCount, uint32_t queryCount, uint64_t touched) {
+	TempMark temp = temp_begin(arena);
+	uint32_t oldNodeCount = bvh->nodeCount;
+	uint32_t *identifiers = alloc(arena, oldNodeCount, uint32_t);
+	for (uint32_t i = 0; i < oldNodeCount; i++) {
+		identifiers[i] = bvh->nodes[i].identifier;
+	}
+
+	double start = bench_seconds();
+	uint32_t *newIds = bvh_reorder(bvh, arena);
+	double reorderTime = bench_seconds() - start;
+
+	for (uint32_t i = 0; i < oldNodeCount; i++) {
+		assert(newIds[i] == 0 || bvh->nodes[newIds[i]].identifier == identifiers[i]);
+	}
+
+	QueryResult queries = run_queries(arena, bvh, entities, entityCount, queryCount);
+	printf("%-12s reorder %6.3fs  queries %8.3fs  %7.3fus/query  touched %llu\n",
+		name, reorderTime, queries.time, queries.time * 1e6 / queryCount, (unsigned long long)queries.touched);
+	assert(queries.touched == touched);
+	temp_end(temp);
+}
+
+int main(int argc, char **argv) {
+	uint32_t entityCount = bench_arg(argc, argv, 1, 1 << 20);
+	uint32_t queryCount = bench_arg(argc, argv, 2, 1 << 16);
+	bool skipIncremental = bench_arg(argc, argv, 3, 0) != 0;
+	uint32_t threadCount = bench_arg(argc, argv, 4, hardware_thread_count());
+
+	Arena arena = arena_create(GB(1024));
+	printf("%u entities, %u random queries\n", entityCount, queryCount);
+
+	srand(1);
+	Bvh incremental = init_bvh(&arena);
+	double start = bench_seconds();
+	Entity *entities;
+	if (skipIncremental) {
+		entities = random_entities(&arena, entityCount, radius_for_density(entityCount));
+	}
+	else {
+		entities = create_random_entities_with_radius(&arena, &incremental, entityCount, radius_for_density(entityCount));
+	}
+	double incrementalBuild = bench_seconds() - start;
+
+	AABB *aabbs = alloc(&arena, entityCount, AABB);
+	for (uint32_t i = 0; i < entityCount; i++) {
+		aabbs[i] = entities[i].ab;
+	}
+
+	start = bench_seconds();
+	Bvh binned = build_bvh(&arena, aabbs, entityCount);
+	double binnedBuild = bench_seconds() - start;
+
+	start = bench_seconds();
+	Bvh linear = build_lbvh(&arena, aabbs, entityCount, threadCount);
+	double linearBuild = bench_seconds() - start;
+
+	QueryResult binnedQueries = run_queries(&arena, &binned, entities, entityCount, queryCount);
+	QueryResult linearQueries = run_queries(&arena, &linear, entities, entityCount, queryCount);
+	assert(linearQueries.touched == binnedQueries.touched);
+	if (!skipIncremental) {
+		QueryResult incrementalQueries = run_queries(&arena, &incremental, entities, entityCount, queryCount);
+		printf("insert_node  build %8.3fs  queries %8.3fs  %7.3fus/query  touched %llu\n",
+			incrementalBuild, incrementalQueries.time, incrementalQueries.time * 1e6 / queryCount, (unsigned long long)incrementalQueries.touched);
+		assert(incrementalQueries.touched == binnedQueries.touched);
+	}
+	printf("build_bvh    build %8.3fs  queries %8.3fs  %7.3fus/query  touched %llu\n",
+		binnedBuild, binnedQueries.time, binnedQueries.time * 1e6 / queryCount, (unsigned long long)binnedQueries.touched);
+	printf("build_lbvh   build %8.3fs  queries %8.3fs  %7.3fus/query  touched %llu  (%u threads)\n",
+		linearBuild, linearQueries.time, linearQueries.time * 1e6 / queryCount, (unsigned long long)linearQueries.touched, threadCount);
+
+	printf("in depth first order\n");
+	if (!skipIncremental) {
+		reorder_and_query(&arena, "insert_node", &incremental, entities, entityCount, queryCount, binnedQueries.touched);
+	}
+	reorder_and_query(&arena, "build_bvh", &binned, entities, entityCount, queryCount, binnedQueries.touched);
+	reorder_and_query(&arena, "build_lbvh", &linear, entities, entityCount, queryCount, binnedQueries.touched);
+}
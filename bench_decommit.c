@@ -0,0 +1,132 @@
+#pragma clang diagnostic ignored "-Wlanguage-extension-token"
+#pragma clang diagnostic ignored "-Wc++20-designator"
+#pragma clang diagnostic ignored "-Wc99-extensions"
+
+#include "arenas.c"
+#include "stuff.c"
+#include "bench.c"
+
+// frames of small, big, small, big, small bytes, every frame fills its memory and ends with arena_clear,
+// once for every decommit policy. after every frame committed and decommitted have to be exactly what the policy promises:
+// NEVER keeps everything, ALWAYS keeps nothing above next, RETAIN keeps what the frame used and at least retain bytes.
+// the big frames after the first one write to pages that were given back before, so they have to be committed again.
+// then a shrink in the middle of a cycle, and a split arena joined back while ALWAYS is active
+
+// usage: bench_decommit [smallMB] [bigMB]
+
+// where committed ends up when everything up to ptr is committed, commits happen in whole blocks
+char* committed_for(Arena *arena, char *ptr) {
+	return (char*)align_forward((uintptr_t)ptr, arena->commitSize);
+}
+
+void fill(char *bytes, size_t size, char value) {
+	memset(bytes, value, size);
+	for (size_t i = 0; i < size; i += PAGE_SIZE) {
+		assert(bytes[i] == value);
+	}
+}
+
+const char *policyNames[] = { "never", "always", "retain" };
+
+void run_frames(DecommitPolicy policy, size_t small, size_t big) {
+	Arena arena = arena_create(GB(64));
+	size_t retain = small / 2;
+	arena_set_decommit_policy(&arena, policy, retain);
+
+	size_t frames[] = { small, big, small, big, small };
+	char *committed = arena.committed;
+	uint64_t decommitted = 0;
+
+	for (uint32_t f = 0; f < sizeof(frames) / sizeof(frames[0]); f++) {
+		double start = bench_seconds();
+		char *bytes = alloc(&arena, frames[f], char);
+		fill(bytes, frames[f], (char)(f + 1));
+		arena_clear(&arena);
+		double time = bench_seconds() - start;
+
+		// what the frame committed, then what the clear gives back of it
+		committed = max_ptr(committed, committed_for(&arena, arena.start + frames[f]));
+		char *keep = arena.start;
+		if (policy == DECOMMIT_NEVER) {
+			keep = committed;
+		}
+		else if (policy == DECOMMIT_RETAIN) {
+			keep = arena.start + ((frames[f] > retain) ? frames[f] : retain);
+		}
+		char *kept = committed_for(&arena, keep);
+		if ((uintptr_t)kept < (uintptr_t)committed) {
+			decommitted += committed - kept;
+			committed = kept;
+		}
+
+		printf("%-6s frame %u %6zuMB  %8.2fms  committed %6.2fMB  decommitted %7.2fMB\n", policyNames[policy], f, frames[f] / MB(1),
+			time * 1e3, (double)(arena.committed - arena.start) / MB(1), (double)arena.decommitted / MB(1));
+		assert(arena.next == arena.start);
+		assert(arena.committed == committed);
+		assert(arena.decommitted == decommitted);
+	}
+
+	os_release(arena.start, arena.end - arena.start);
+}
+
+// a shrink in the middle of a cycle gives back what lies above the new next right away under ALWAYS
+void run_shrink(size_t small, size_t big) {
+	Arena arena = arena_create(GB(64));
+	arena_set_decommit_policy(&arena, DECOMMIT_ALWAYS, 0);
+
+	char *bytes = alloc(&arena, big, char);
+	fill(bytes, big, 1);
+	char *committed = arena.committed;
+
+	arena_shrink_to_pointer(&arena, bytes + small);
+	assert(arena.committed == committed_for(&arena, bytes + small));
+	assert(arena.decommitted == (uint64_t)(committed - arena.committed));
+
+	// the small part stays, the blocks that were given back come back zeroed
+	assert(bytes[0] == 1 && bytes[small - 1] == 1);
+	char *again = alloc(&arena, big - small, char);
+	char *given = committed_for(&arena, bytes + small);
+	assert(given[0] == 0 && again[big - small - 1] == 0);
+	fill(again, big - small, 2);
+
+	printf("shrink  kept %6.2fMB  decommitted %7.2fMB\n", (double)(committed_for(&arena, bytes + small) - arena.start) / MB(1), (double)arena.decommitted / MB(1));
+	os_release(arena.start, arena.end - arena.start);
+}
+
+// the pages a child committed belong to the parent after the join, so the parents next shrink gives them back
+void run_split_join(size_t small, size_t big) {
+	Arena arena = arena_create(GB(64));
+	arena_set_decommit_policy(&arena, DECOMMIT_ALWAYS, 0);
+
+	char *mark = arena.next;
+	Arena child = split_arena(&arena, big);
+	char *bytes = alloc(&child, small, char);
+	fill(bytes, small, 3);
+	char *childCommitted = child.committed;
+	arena_join(&arena, &child);
+	assert(arena.committed == childCommitted && arena.next == bytes + small);
+
+	arena_shrink_to_pointer(&arena, mark);
+	assert(arena.next == mark);
+	assert(arena.committed == committed_for(&arena, mark));
+	assert(arena.decommitted == (uint64_t)(childCommitted - arena.committed));
+
+	// over the childs old pages and beyond
+	bytes = alloc(&arena, big, char);
+	fill(bytes, big, 4);
+
+	printf("split and join  decommitted %7.2fMB\n", (double)arena.decommitted / MB(1));
+	os_release(arena.start, arena.end - arena.start);
+}
+
+int main(int argc, char **argv) {
+	size_t small = MB(bench_arg(argc, argv, 1, 16));
+	size_t big = MB(bench_arg(argc, argv, 2, 256));
+	assert(small < big);
+
+	run_frames(DECOMMIT_NEVER, small, big);
+	run_frames(DECOMMIT_ALWAYS, small, big);
+	run_frames(DECOMMIT_RETAIN, small, big);
+	run_shrink(small, big);
+	run_split_join(small, big);
+}
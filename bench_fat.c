@@ -0,0 +1,226 @@
+#pragma clang diagnostic ignored "-Wlanguage-extension-token"
+#pragma clang diagnostic ignored "-Wc++20-designator"
+#pragma clang diagnostic ignored "-Wc99-extensions"
+
+#include "arenas.c"
+#include "stuff.c"
+#include "bench.c"
+
+// moves all entities every frame and keeps the bvh up to date with update_leaf, then finds all collisions
+// once for every margin, so we can see what a margin saves in updates and costs in queries
+// and once more with tree rotations, sah is the bvh_sah_cost after the last frame
+// every run has to find the same collisions, the margin and rotations must only change the speed
+// then leaves are removed and reinserted, to see that the freed nodes are reused and the tree stays correct
+
+// usage: bench_fat [entityCount] [frameCount]
+
+typedef struct FatResult {
+	double updateTime;
+	double queryTime;
+	uint64_t collisions;
+	float sahCost;
+} FatResult;
+
+FatResult run(uint32_t entityCount, uint32_t frameCount, float margin, float velocityScale, bool rotate, BvhStats *statsOut) {
+	Arena arena = arena_create(GB(64));
+	float maxRadius = radius_for_density(entityCount);
+
+	srand(1);
+	Entity *entities = random_entities(&arena, entityCount, maxRadius);
+	Vector *velocities = alloc(&arena, entityCount, Vector);
+	uint32_t *leaves = alloc(&arena, entityCount, uint32_t);
+
+	// most entities crawl, every tenth one is fast
+	for (uint32_t i = 0; i < entityCount; i++) {
+		float speed = maxRadius * ((rand() % 10 == 0) ? 0.5f : 0.02f);
+		velocities[i] = mulf(random_vector(), speed);
+	}
+
+	Bvh bvh = init_bvh(&arena);
+	bvh.margin = margin;
+	bvh.velocityScale = velocityScale;
+	bvh.rotate = rotate;
+	for (uint32_t i = 0; i < entityCount; i++) {
+		leaves[i] = insert_node(&bvh, i, entities[i].ab);
+	}
+
+	uint32_t *touched = alloc(&arena, entityCount, uint32_t);
+	uint32_t *nodeStack = alloc(&arena, 2 * entityCount, uint32_t);
+
+	FatResult result = {0};
+	for (uint32_t frame = 0; frame < frameCount; frame++) {
+		double start = bench_seconds();
+		for (uint32_t i = 0; i < entityCount; i++) {
+			Entity *entity = entities + i;
+			entity->position = add(entity->position, velocities[i]);
+
+			// bounce off the walls of the unit cube
+			if (fabsf(entity->position.x) > 0.5f) velocities[i].x = -velocities[i].x;
+			if (fabsf(entity->position.y) > 0.5f) velocities[i].y = -velocities[i].y;
+			if (fabsf(entity->position.z) > 0.5f) velocities[i].z = -velocities[i].z;
+
+			entity->ab = (AABB){ subf(entity->position, entity->radius), addf(entity->position, entity->radius) };
+			update_leaf(&bvh, leaves[i], entity->ab, velocities[i]);
+		}
+		result.updateTime += bench_seconds() - start;
+
+		start = bench_seconds();
+		for (uint32_t i = 0; i < entityCount; i++) {
+			uint32_t touchedCount = bvh_query(&bvh, entities[i].ab, touched, nodeStack);
+			bvh_count_query(&bvh, entities, entities[i].ab, touched, touchedCount);
+
+			for (uint32_t j = 0; j < touchedCount; j++) {
+				if (touched[j] != i && entity_collides(entities, i, touched[j])) {
+					result.collisions++;
+				}
+			}
+		}
+		result.queryTime += bench_seconds() - start;
+	}
+
+	result.sahCost = bvh_sah_cost(&bvh);
+	*statsOut = bvh.stats;
+	os_release(arena.start, arena.end - arena.start);
+	return result;
+}
+
+int compare_ids(const void *a, const void *b) {
+	uint32_t idA = *(const uint32_t*)a;
+	uint32_t idB = *(const uint32_t*)b;
+	return (idA > idB) - (idA < idB);
+}
+
+// every child points back at its parent, every box holds its children, and there are as many leaves as the bvh thinks
+void check_tree(Bvh *bvh, uint32_t *nodeStack) {
+	uint32_t leaves = 0;
+	uint32_t stackCount = 0;
+	if (bvh->root != 0) {
+		assert(bvh->nodes[bvh->root].parent == 0);
+		nodeStack[stackCount++] = bvh->root;
+	}
+	while (stackCount > 0) {
+		uint32_t nodeId = nodeStack[--stackCount];
+		Node *node = bvh->nodes + nodeId;
+		if (is_leaf(node)) {
+			leaves++;
+			continue;
+		}
+		uint32_t children[2] = { node->left, node->right };
+		for (uint32_t c = 0; c < 2; c++) {
+			assert(bvh->nodes[children[c]].parent == nodeId);
+			assert(aabb_contains(node->aabb, bvh->nodes[children[c]].aabb));
+			nodeStack[stackCount++] = children[c];
+		}
+	}
+	assert(leaves == bvh->leavesCount);
+}
+
+// removes a random tenth of the leaves every round and inserts them again somewhere else.
+// the freed nodes have to be reused, so there are never more than 2 nodes per leaf, the null node included,
+// and the tree has to answer queries exactly like testing every entity by hand
+void churn(uint32_t entityCount, uint32_t roundCount, bool rotate) {
+	Arena arena = arena_create(GB(64));
+	float maxRadius = radius_for_density(entityCount);
+
+	srand(2);
+	Entity *entities = random_entities(&arena, entityCount, maxRadius);
+	uint32_t *leaves = alloc(&arena, entityCount, uint32_t);
+	bool *alive = alloc(&arena, entityCount, bool);
+
+	Bvh bvh = init_bvh(&arena);
+	bvh.rotate = rotate;
+	for (uint32_t i = 0; i < entityCount; i++) {
+		leaves[i] = insert_node(&bvh, i, entities[i].ab);
+		alive[i] = true;
+	}
+
+	uint32_t *touched = alloc(&arena, entityCount, uint32_t);
+	uint32_t *expected = alloc(&arena, entityCount, uint32_t);
+	uint32_t *nodeStack = alloc(&arena, 2 * entityCount, uint32_t);
+	uint32_t *removed = alloc(&arena, entityCount, uint32_t);
+
+	double start = bench_seconds();
+	for (uint32_t round = 0; round < roundCount; round++) {
+		uint32_t removedCount = 0;
+		for (uint32_t i = 0; i < entityCount; i++) {
+			if (rand() % 10 == 0) {
+				remove_leaf(&bvh, leaves[i]);
+				alive[i] = false;
+				removed[removedCount++] = i;
+			}
+		}
+		assert(bvh.leavesCount == entityCount - removedCount);
+		check_tree(&bvh, nodeStack);
+
+		// half the queries while the removed entities are gone, half after they are back
+		for (uint32_t half = 0; half < 2; half++) {
+			for (uint32_t q = 0; q < 64; q++) {
+				AABB query = entities[rand() % entityCount].ab;
+				uint32_t touchedCount = bvh_query(&bvh, query, touched, nodeStack);
+
+				uint32_t expectedCount = 0;
+				for (uint32_t i = 0; i < entityCount; i++) {
+					if (alive[i] && aabb_intersects_aabb(entities[i].ab, query)) {
+						expected[expectedCount++] = i;
+					}
+				}
+				qsort(touched, touchedCount, sizeof(uint32_t), compare_ids);
+				assert(touchedCount == expectedCount && memcmp(touched, expected, touchedCount * sizeof(uint32_t)) == 0);
+			}
+
+			if (half == 0) {
+				for (uint32_t r = 0; r < removedCount; r++) {
+					uint32_t i = removed[r];
+					Entity *entity = entities + i;
+					entity->position = random_vector();
+					entity->ab = (AABB){ subf(entity->position, entity->radius), addf(entity->position, entity->radius) };
+					leaves[i] = insert_node(&bvh, i, entity->ab);
+					alive[i] = true;
+				}
+				assert(bvh.leavesCount == entityCount);
+				assert(bvh.nodeCount <= 2 * bvh.leavesCount);
+				check_tree(&bvh, nodeStack);
+			}
+		}
+	}
+	double time = bench_seconds() - start;
+
+	printf("churn %-8s %u rounds of removing and reinserting a tenth  %7.2fms per round  nodes %u for %u leaves\n",
+		rotate ? "rotated" : "", roundCount, time * 1e3 / roundCount, bvh.nodeCount, bvh.leavesCount);
+	os_release(arena.start, arena.end - arena.start);
+}
+
+int main(int argc, char **argv) {
+	uint32_t entityCount = bench_arg(argc, argv, 1, 20000);
+	uint32_t frameCount = bench_arg(argc, argv, 2, 20);
+
+	// margins relative to the largest radius
+	float margins[] = { 0.0f, 0.05f, 0.1f, 0.25f, 0.5f };
+	float velocityScales[] = { 0.0f, 4.0f };
+	float maxRadius = radius_for_density(entityCount);
+
+	printf("%u entities, %u frames, times are per frame\n", entityCount, frameCount);
+	uint64_t collisions = 0;
+	for (int rotate = 0; rotate < 2; rotate++) {
+		for (int v = 0; v < 2; v++) {
+			for (uint32_t m = 0; m < sizeof(margins) / sizeof(margins[0]); m++) {
+				BvhStats stats;
+				FatResult result = run(entityCount, frameCount, margins[m] * maxRadius, velocityScales[v], rotate, &stats);
+
+				printf("margin %4.2fr velocity x%.0f %-8s reinserted %6.2f%%  update %7.2fms  touched/query %6.2f  by margin %6.2f%%  query %7.2fms  sah %7.2f\n",
+					margins[m], velocityScales[v], rotate ? "rotated" : "",
+					100.0 * stats.reinserts / stats.updates, result.updateTime * 1e3 / frameCount,
+					(double)stats.touched / stats.queries, 100.0 * stats.touchedByMargin / stats.touched, result.queryTime * 1e3 / frameCount,
+					result.sahCost);
+
+				if (collisions == 0) {
+					collisions = result.collisions;
+				}
+				assert(result.collisions == collisions);
+			}
+		}
+	}
+
+	churn(entityCount, frameCount, false);
+	churn(entityCount, frameCount, true);
+}
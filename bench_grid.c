@@ -0,0 +1,161 @@
+#pragma clang diagnostic ignored "-Wlanguage-extension-token"
+#pragma clang diagnostic ignored "-Wc++20-designator"
+#pragma clang diagnostic ignored "-Wc99-extensions"
+
+#include "arenas.c"
+#include "stuff.c"
+#include "bench.c"
+#include "threads.c"
+#include "collisions.c"
+#include "bvh_build.c"
+#include "grid.c"
+
+// the grid against the bvh, both built from scratch and then asked for
+// the collisions of every entity, and for all pairs of overlapping aabbs
+// for several scene sizes and three kinds of radii, every time includes the build
+// both have to find the same collisions and the same pairs, only in a different order
+
+// usage: bench_grid [maxEntityCount]
+
+typedef enum RadiusKind {
+	RADIUS_RANDOM,  // random_float() * maxRadius, like create_random_entities
+	RADIUS_EQUAL,   // all the same, maxRadius / 2
+	RADIUS_FEW_BIG, // random, but every hundredth entity 8 times bigger
+	RADIUS_KIND_COUNT,
+} RadiusKind;
+
+const char *radiusNames[RADIUS_KIND_COUNT] = { "random", "equal", "few big" };
+
+// a hash of a pair that doesnt care which entity comes first, summed up so the order doesnt matter either
+uint64_t pair_hash(uint32_t a, uint32_t b) {
+	uint32_t low = (a < b) ? a : b;
+	uint32_t high = (a < b) ? b : a;
+	return (((uint64_t)low << 32) | high) * 0x9e3779b97f4a7c15ull;
+}
+
+Entity* scene(Arena *arena, uint32_t entityCount, RadiusKind kind) {
+	float maxRadius = radius_for_density(entityCount);
+	srand(1);
+	Entity *entities = random_entities(arena, entityCount, maxRadius);
+
+	for (uint32_t i = 0; i < entityCount; i++) {
+		Entity *entity = entities + i;
+		if (kind == RADIUS_EQUAL) {
+			entity->radius = 0.5f * maxRadius;
+		}
+		else if (kind == RADIUS_FEW_BIG && i % 100 == 0) {
+			entity->radius *= 8.0f;
+		}
+		entity->ab = (AABB){ subf(entity->position, entity->radius), addf(entity->position, entity->radius) };
+	}
+	return entities;
+}
+
+typedef struct BroadResult {
+	double collideTime;
+	double pairsTime;
+	uint64_t collisions;
+	uint64_t collisionsHash;
+	uint64_t pairs;
+	uint64_t pairsHash;
+} BroadResult;
+
+BroadResult run_bvh(Arena *arena, Entity *entities, uint32_t entityCount) {
+	BroadResult result = {0};
+	TempMark temp = temp_begin(arena);
+
+	double start = bench_seconds();
+	AABB *aabbs = alloc(arena, entityCount, AABB);
+	for (uint32_t i = 0; i < entityCount; i++) {
+		aabbs[i] = entities[i].ab;
+	}
+	Bvh bvh = build_bvh(arena, aabbs, entityCount);
+	uint32_t *touched = alloc(arena, entityCount, uint32_t);
+	uint32_t *nodeStack = alloc(arena, bvh.nodeCount, uint32_t);
+	for (uint32_t i = 0; i < entityCount; i++) {
+		uint32_t count;
+		uint32_t *collisions = collide_entity(arena, &bvh, entities, i, touched, nodeStack, &count);
+		result.collisions += count;
+		for (uint32_t j = 0; j < count; j++) {
+			result.collisionsHash += pair_hash(i, collisions[j]);
+		}
+	}
+	result.collideTime = bench_seconds() - start;
+	temp_end(temp);
+
+	start = bench_seconds();
+	aabbs = alloc(arena, entityCount, AABB);
+	for (uint32_t i = 0; i < entityCount; i++) {
+		aabbs[i] = entities[i].ab;
+	}
+	bvh = build_bvh(arena, aabbs, entityCount);
+	uint32_t pairCount;
+	BvhPair *pairs = bvh_self_pairs(&bvh, arena, &pairCount);
+	result.pairsTime = bench_seconds() - start;
+
+	result.pairs = pairCount;
+	for (uint32_t i = 0; i < pairCount; i++) {
+		result.pairsHash += pair_hash(pairs[i].a, pairs[i].b);
+	}
+	temp_end(temp);
+	return result;
+}
+
+BroadResult run_grid(Arena *arena, Entity *entities, uint32_t entityCount) {
+	BroadResult result = {0};
+	TempMark temp = temp_begin(arena);
+
+	double start = bench_seconds();
+	Grid grid = build_grid(arena, entities, entityCount);
+	for (uint32_t i = 0; i < entityCount; i++) {
+		uint32_t count;
+		uint32_t *collisions = grid_collide_entity(arena, &grid, entities, i, &count);
+		result.collisions += count;
+		for (uint32_t j = 0; j < count; j++) {
+			result.collisionsHash += pair_hash(i, collisions[j]);
+		}
+	}
+	result.collideTime = bench_seconds() - start;
+	temp_end(temp);
+
+	start = bench_seconds();
+	grid = build_grid(arena, entities, entityCount);
+	uint32_t pairCount;
+	BvhPair *pairs = grid_self_pairs(&grid, arena, &pairCount);
+	result.pairsTime = bench_seconds() - start;
+
+	result.pairs = pairCount;
+	for (uint32_t i = 0; i < pairCount; i++) {
+		assert(pairs[i].a < pairs[i].b);
+		result.pairsHash += pair_hash(pairs[i].a, pairs[i].b);
+	}
+	temp_end(temp);
+	return result;
+}
+
+int main(int argc, char **argv) {
+	uint32_t maxEntityCount = bench_arg(argc, argv, 1, 1 << 20);
+
+	Arena arena = arena_create(GB(1024));
+	printf("times include building, collisions is collide_entity for every entity, pairs the self pairs\n");
+
+	for (uint32_t entityCount = 10000; entityCount <= maxEntityCount; entityCount *= 10) {
+		for (int kind = 0; kind < RADIUS_KIND_COUNT; kind++) {
+			TempMark temp = temp_begin(&arena);
+			Entity *entities = scene(&arena, entityCount, kind);
+
+			BroadResult bvh = run_bvh(&arena, entities, entityCount);
+			BroadResult grid = run_grid(&arena, entities, entityCount);
+
+			printf("%8u %-8s  collisions: bvh %8.3fs  grid %8.3fs  %5.2fx   pairs: bvh %8.3fs  grid %8.3fs  %5.2fx   (%llu collisions, %llu pairs)\n",
+				entityCount, radiusNames[kind],
+				bvh.collideTime, grid.collideTime, bvh.collideTime / grid.collideTime,
+				bvh.pairsTime, grid.pairsTime, bvh.pairsTime / grid.pairsTime,
+				(unsigned long long)bvh.collisions, (unsigned long long)bvh.pairs);
+
+			assert(bvh.collisions == grid.collisions && bvh.collisionsHash == grid.collisionsHash);
+			assert(bvh.pairs == grid.pairs && bvh.pairsHash == grid.pairsHash);
+			temp_end(temp);
+		}
+	}
+}
@@ -0,0 +1,72 @@
+#pragma clang diagnostic ignored "-Wlanguage-extension-token"
+#pragma clang diagnostic ignored "-Wc++20-designator"
+#pragma clang diagnostic ignored "-Wc99-extensions"
+
+#include "arenas.c"
+#include "stuff.c"
+#include "bench.c"
+
+// the bvh nodes and the entities are reserved at GB scale and accessed randomly
+// with 4KB pages almost every node we visit needs its own TLB entry, with 2MB pages 512 times fewer
+
+// usage: bench_hugepages [entityCount] [queryCount]
+
+uint64_t anon_huge_page_bytes(void) {
+	uint64_t kb = 0;
+#if !defined(_WIN32)
+	FILE *file = fopen("/proc/self/smaps_rollup", "r");
+	if (file) {
+		char line[256];
+		while (fgets(line, sizeof(line), file)) {
+			if (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+				break;
+			}
+		}
+		fclose(file);
+	}
+#endif
+	return kb * 1024;
+}
+
+void run(const char *name, uint32_t flags, size_t populate, uint32_t entityCount, uint32_t queryCount) {
+	Arena arena = arena_create_flags(GB(32), flags, populate);
+
+	srand(1);
+	double buildStart = bench_seconds();
+	Bvh bvh = init_bvh(&arena);
+	Entity *entities = create_random_entities_with_radius(&arena, &bvh, entityCount, radius_for_density(entityCount));
+	double buildTime = bench_seconds() - buildStart;
+
+	Arena tempArena = split_arena(&arena, GB(4));
+	uint32_t *touched = alloc(&tempArena, bvh.leavesCount, uint32_t);
+	uint32_t *nodeStack = alloc(&tempArena, bvh.nodeCount, uint32_t);
+
+	srand(2);
+	uint64_t touchedTotal = 0;
+	double queryStart = bench_seconds();
+	for (uint32_t i = 0; i < queryCount; i++) {
+		uint32_t id = (uint32_t)(((uint64_t)rand() * RAND_MAX + rand()) % entityCount);
+		touchedTotal += bvh_query(&bvh, entities[id].ab, touched, nodeStack);
+	}
+	double queryTime = bench_seconds() - queryStart;
+
+	printf("%-22s build %8.3fs  queries %8.3fs  %7.3fus/query  touched %llu  huge pages %lluMB\n",
+		name, buildTime, queryTime, queryTime * 1e6 / queryCount,
+		(unsigned long long)touchedTotal, (unsigned long long)(anon_huge_page_bytes() >> 20));
+
+	os_release(arena.start, arena.end - arena.start);
+}
+
+int main(int argc, char **argv) {
+	uint32_t entityCount = bench_arg(argc, argv, 1, 1 << 20);
+	uint32_t queryCount = bench_arg(argc, argv, 2, 1 << 16);
+
+	// the bvh nodes are split off first, so populating the start of the arena prefaults them
+	size_t nodeBytes = (size_t)2 * entityCount * sizeof(Node);
+
+	printf("%u entities, %u nodes, %u random queries\n", entityCount, 2 * entityCount - 1, queryCount);
+	run("4KB pages", 0, 0, entityCount, queryCount);
+	run("4KB pages, populated", 0, nodeBytes, entityCount, queryCount);
+	run("2MB pages", ARENA_HUGE_PAGES, 0, entityCount, queryCount);
+	run("2MB pages, populated", ARENA_HUGE_PAGES, nodeBytes, entityCount, queryCount);
+}
@@ -0,0 +1,160 @@
+#pragma clang diagnostic ignored "-Wlanguage-extension-token"
+#pragma clang diagnostic ignored "-Wc++20-designator"
+#pragma clang diagnostic ignored "-Wc99-extensions"
+
+#include "arenas.c"
+#include "stuff.c"
+#include "bench.c"
+#include "threads.c"
+#include "collisions.c"
+#include "bvh_build.c"
+#include "bvh_wide.c"
+#include "narrow_phase.c"
+
+// the narrow phase alone: the candidates of every entity are queried once up front,
+// then every kernel tests all of them, the AoS entity_collides loop from collide_entity being the baseline.
+// every kernel has to find the same collisions in the same order.
+// then the whole collide_entity against collide_entity_soa and collide_entity_fused, query included
+
+// usage: bench_narrow [entityCount] [radiusScale]
+// radiusScale makes the scene denser, more candidates per query
+
+typedef struct NarrowResult {
+	double time;
+	uint64_t collisions;
+	uint64_t hash;
+} NarrowResult;
+
+uint64_t hash_ids(uint64_t hash, const uint32_t *ids, uint32_t count) {
+	hash = (hash ^ count) * 1099511628211ull;
+	for (uint32_t i = 0; i < count; i++) {
+		hash = (hash ^ ids[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+void print_narrow(const char *name, NarrowResult result, NarrowResult baseline, uint64_t candidates) {
+	printf("%-16s %8.3fs  %6.2fns/candidate  %5.2fx  collisions %llu\n",
+		name, result.time, result.time * 1e9 / candidates, baseline.time / result.time, (unsigned long long)result.collisions);
+	assert(result.collisions == baseline.collisions && result.hash == baseline.hash);
+}
+
+int main(int argc, char **argv) {
+	uint32_t entityCount = bench_arg(argc, argv, 1, 1 << 20);
+	uint32_t radiusScale = bench_arg(argc, argv, 2, 2);
+
+	Arena arena = arena_create(GB(1024));
+
+	srand(1);
+	Entity *entities = random_entities(&arena, entityCount, (float)radiusScale * radius_for_density(entityCount));
+	AABB *aabbs = alloc(&arena, entityCount, AABB);
+	for (uint32_t i = 0; i < entityCount; i++) {
+		aabbs[i] = entities[i].ab;
+	}
+	Bvh bvh = build_bvh(&arena, aabbs, entityCount);
+	EntitySoa soa = entities_to_soa(&arena, entities, entityCount);
+
+	uint32_t *touched = alloc(&arena, entityCount, uint32_t);
+	uint32_t *nodeStack = alloc(&arena, bvh.nodeCount, uint32_t);
+
+	uint32_t **candidates = alloc(&arena, entityCount, uint32_t*);
+	uint32_t *candidateCounts = alloc(&arena, entityCount, uint32_t);
+	uint64_t candidateTotal = 0;
+	for (uint32_t i = 0; i < entityCount; i++) {
+		candidateCounts[i] = bvh_query(&bvh, entities[i].ab, touched, nodeStack);
+		candidates[i] = alloc(&arena, candidateCounts[i], uint32_t);
+		memcpy(candidates[i], touched, candidateCounts[i] * sizeof(uint32_t));
+		candidateTotal += candidateCounts[i];
+	}
+	printf("%u entities, radius x%u, %.2f candidates per entity\n", entityCount, radiusScale, (double)candidateTotal / entityCount);
+
+	uint32_t *collisions = alloc(&arena, entityCount + 8, uint32_t);
+
+	NarrowResult aos = {0};
+	double start = bench_seconds();
+	for (uint32_t i = 0; i < entityCount; i++) {
+		uint32_t count = 0;
+		for (uint32_t j = 0; j < candidateCounts[i]; j++) {
+			uint32_t candidate = candidates[i][j];
+			if (candidate != i && entity_collides(entities, i, candidate)) {
+				collisions[count++] = candidate;
+			}
+		}
+		aos.collisions += count;
+		aos.hash = hash_ids(aos.hash, collisions, count);
+	}
+	aos.time = bench_seconds() - start;
+	print_narrow("entity_collides", aos, aos, candidateTotal);
+
+	NarrowPhaseFunction *kernels[4];
+	const char *names[4];
+	uint32_t kernelCount = 0;
+	kernels[kernelCount] = narrow_phase_scalar;
+	names[kernelCount++] = "soa scalar";
+#if BVH_WIDE_SSE
+	build_bvh8_compact_table();
+	if (cpu_has_avx2()) {
+		kernels[kernelCount] = narrow_phase_avx2;
+		names[kernelCount++] = "soa avx2";
+	}
+	if (cpu_has_avx512()) {
+		kernels[kernelCount] = narrow_phase_avx512;
+		names[kernelCount++] = "soa avx512";
+	}
+#endif
+	kernels[kernelCount] = narrow_phase;
+	names[kernelCount++] = "narrow_phase";
+
+	for (uint32_t k = 0; k < kernelCount; k++) {
+		NarrowResult result = {0};
+		start = bench_seconds();
+		for (uint32_t i = 0; i < entityCount; i++) {
+			uint32_t count = kernels[k](&soa, i, candidates[i], candidateCounts[i], collisions);
+			result.collisions += count;
+			result.hash = hash_ids(result.hash, collisions, count);
+		}
+		result.time = bench_seconds() - start;
+		print_narrow(names[k], result, aos, candidateTotal);
+	}
+
+	// and the whole thing, query included
+	NarrowResult whole = {0};
+	TempMark temp = temp_begin(&arena);
+	start = bench_seconds();
+	for (uint32_t i = 0; i < entityCount; i++) {
+		uint32_t count;
+		uint32_t *entityCollisions = collide_entity(&arena, &bvh, entities, i, touched, nodeStack, &count);
+		whole.collisions += count;
+		whole.hash = hash_ids(whole.hash, entityCollisions, count);
+	}
+	whole.time = bench_seconds() - start;
+	temp_end(temp);
+	print_narrow("collide_entity", whole, aos, candidateTotal);
+
+	NarrowResult wholeSoa = {0};
+	temp = temp_begin(&arena);
+	start = bench_seconds();
+	for (uint32_t i = 0; i < entityCount; i++) {
+		uint32_t count;
+		uint32_t *entityCollisions = collide_entity_soa(&arena, &bvh, &soa, i, touched, nodeStack, &count);
+		wholeSoa.collisions += count;
+		wholeSoa.hash = hash_ids(wholeSoa.hash, entityCollisions, count);
+	}
+	wholeSoa.time = bench_seconds() - start;
+	temp_end(temp);
+	print_narrow("collide soa", wholeSoa, whole, candidateTotal);
+
+	LeafSphere *spheres = bvh_leaf_spheres(&arena, &bvh, entities);
+	NarrowResult wholeFused = {0};
+	temp = temp_begin(&arena);
+	start = bench_seconds();
+	for (uint32_t i = 0; i < entityCount; i++) {
+		uint32_t count;
+		uint32_t *entityCollisions = collide_entity_fused(&arena, &bvh, spheres, entities, i, nodeStack, &count);
+		wholeFused.collisions += count;
+		wholeFused.hash = hash_ids(wholeFused.hash, entityCollisions, count);
+	}
+	wholeFused.time = bench_seconds() - start;
+	temp_end(temp);
+	print_narrow("collide fused", wholeFused, whole, candidateTotal);
+}
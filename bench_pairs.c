@@ -0,0 +1,88 @@
+#pragma clang diagnostic ignored "-Wlanguage-extension-token"
+#pragma clang diagnostic ignored "-Wc++20-designator"
+#pragma clang diagnostic ignored "-Wc99-extensions"
+
+#include "arenas.c"
+#include "stuff.c"
+#include "bench.c"
+#include "threads.c"
+#include "collisions.c"
+#include "bvh_build.c"
+
+// all colliding pairs of a scene, once by querying the bvh for every entity and once with bvh_self_pairs
+// for denser and denser scenes, the radius is a multiple of what the other benchmarks use
+// the queries find every pair twice, the self pairs once, but both have to find the same pairs
+
+// usage: bench_pairs [entityCount]
+
+// a hash of a pair that doesnt care which entity comes first, summed up over all pairs
+uint64_t pair_hash(uint32_t a, uint32_t b) {
+	uint32_t low = (a < b) ? a : b;
+	uint32_t high = (a < b) ? b : a;
+	return (((uint64_t)low << 32) | high) * 0x9e3779b97f4a7c15ull;
+}
+
+int main(int argc, char **argv) {
+	uint32_t entityCount = bench_arg(argc, argv, 1, 1 << 20);
+	float densities[] = { 1.0f, 2.0f, 3.0f };
+
+	Arena arena = arena_create(GB(1024));
+	printf("%u entities\n", entityCount);
+
+	for (int d = 0; d < sizeof(densities) / sizeof(densities[0]); d++) {
+		TempMark temp = temp_begin(&arena);
+
+		srand(1);
+		Entity *entities = random_entities(&arena, entityCount, densities[d] * radius_for_density(entityCount));
+		AABB *aabbs = alloc(&arena, entityCount, AABB);
+		for (uint32_t i = 0; i < entityCount; i++) {
+			aabbs[i] = entities[i].ab;
+		}
+		Bvh bvh = build_bvh(&arena, aabbs, entityCount);
+
+		uint32_t *touched = alloc(&arena, entityCount, uint32_t);
+		uint32_t *nodeStack = alloc(&arena, bvh.nodeCount, uint32_t);
+
+		// every entity on its own, like the demos do it
+		TempMark queriesTemp = temp_begin(&arena);
+		uint64_t queryCollisions = 0;
+		uint64_t queryHash = 0;
+		double start = bench_seconds();
+		for (uint32_t i = 0; i < entityCount; i++) {
+			uint32_t collisionsCount;
+			uint32_t *collisions = collide_entity(&arena, &bvh, entities, i, touched, nodeStack, &collisionsCount);
+			queryCollisions += collisionsCount;
+			for (uint32_t j = 0; j < collisionsCount; j++) {
+				queryHash += pair_hash(i, collisions[j]);
+			}
+		}
+		double queryTime = bench_seconds() - start;
+		temp_end(queriesTemp);
+
+		// the tree against itself, the overlapping aabbs are then narrowed down to the real collisions in place
+		TempMark pairsTemp = temp_begin(&arena);
+		start = bench_seconds();
+		uint32_t pairCount;
+		BvhPair *pairs = bvh_self_pairs(&bvh, &arena, &pairCount);
+		uint32_t collisionsCount = 0;
+		for (uint32_t i = 0; i < pairCount; i++) {
+			if (entity_collides(entities, pairs[i].a, pairs[i].b)) {
+				pairs[collisionsCount++] = pairs[i];
+			}
+		}
+		double pairsTime = bench_seconds() - start;
+
+		uint64_t pairsHash = 0;
+		for (uint32_t i = 0; i < collisionsCount; i++) {
+			assert(pairs[i].a < pairs[i].b);
+			pairsHash += 2 * pair_hash(pairs[i].a, pairs[i].b);
+		}
+		temp_end(pairsTemp);
+
+		printf("radius x%.0f  queries %8.3fs  self pairs %8.3fs  %5.2fx faster  overlapping aabbs %u  collisions %u\n",
+			densities[d], queryTime, pairsTime, queryTime / pairsTime, pairCount, collisionsCount);
+		assert(queryCollisions == 2 * (uint64_t)collisionsCount && queryHash == pairsHash);
+
+		temp_end(temp);
+	}
+}
@@ -0,0 +1,155 @@
+#pragma clang diagnostic ignored "-Wlanguage-extension-token"
+#pragma clang diagnostic ignored "-Wc++20-designator"
+#pragma clang diagnostic ignored "-Wc99-extensions"
+
+#include "arenas.c"
+#include "stuff.c"
+#include "bench.c"
+#include "threads.c"
+#include "collisions.c"
+#include "bvh_build.c"
+#include "sap.c"
+
+// moves all entities every frame like bench_fat, then finds all pairs of overlapping aabbs three ways:
+// sweep and prune kept sorted with sap_update, sweep and prune sorted from scratch with build_sap, and a new bvh with bvh_self_pairs.
+// all three have to find the same pairs every frame.
+// after the last frame the collisions of every entity, with sap_collide_entity against collide_entity
+
+// usage: bench_sap [entityCount] [frameCount]
+
+// a hash of a pair that doesnt care which entity comes first, summed up so the order doesnt matter either
+uint64_t pair_hash(uint32_t a, uint32_t b) {
+	uint32_t low = (a < b) ? a : b;
+	uint32_t high = (a < b) ? b : a;
+	return (((uint64_t)low << 32) | high) * 0x9e3779b97f4a7c15ull;
+}
+
+uint64_t pairs_hash(BvhPair *pairs, uint32_t pairCount) {
+	uint64_t hash = 0;
+	for (uint32_t i = 0; i < pairCount; i++) {
+		assert(pairs[i].a < pairs[i].b);
+		hash += pair_hash(pairs[i].a, pairs[i].b);
+	}
+	return hash;
+}
+
+int main(int argc, char **argv) {
+	uint32_t entityCount = bench_arg(argc, argv, 1, 20000);
+	uint32_t frameCount = bench_arg(argc, argv, 2, 20);
+
+	Arena arena = arena_create(GB(64));
+	float maxRadius = radius_for_density(entityCount);
+
+	srand(1);
+	Entity *entities = random_entities(&arena, entityCount, maxRadius);
+	Vector *velocities = alloc(&arena, entityCount, Vector);
+
+	// most entities crawl, every tenth one is fast
+	for (uint32_t i = 0; i < entityCount; i++) {
+		float speed = maxRadius * ((rand() % 10 == 0) ? 0.5f : 0.02f);
+		velocities[i] = mulf(random_vector(), speed);
+	}
+
+	SweepAndPrune sap = build_sap(&arena, entities, entityCount);
+	AABB *aabbs = alloc(&arena, entityCount, AABB);
+
+	double updateTime = 0.0, updatePairsTime = 0.0;
+	double rebuildTime = 0.0, rebuildPairsTime = 0.0;
+	double bvhTime = 0.0, bvhPairsTime = 0.0;
+	uint64_t swaps = 0, pairTotal = 0;
+
+	for (uint32_t frame = 0; frame < frameCount; frame++) {
+		for (uint32_t i = 0; i < entityCount; i++) {
+			Entity *entity = entities + i;
+			entity->position = add(entity->position, velocities[i]);
+
+			// bounce off the walls of the unit cube
+			if (fabsf(entity->position.x) > 0.5f) velocities[i].x = -velocities[i].x;
+			if (fabsf(entity->position.y) > 0.5f) velocities[i].y = -velocities[i].y;
+			if (fabsf(entity->position.z) > 0.5f) velocities[i].z = -velocities[i].z;
+
+			entity->ab = (AABB){ subf(entity->position, entity->radius), addf(entity->position, entity->radius) };
+		}
+
+		TempMark temp = temp_begin(&arena);
+
+		double start = bench_seconds();
+		sap_update(&sap, entities);
+		updateTime += bench_seconds() - start;
+		swaps += sap.swaps;
+
+		start = bench_seconds();
+		uint32_t updatePairCount;
+		BvhPair *updatePairs = sap_self_pairs(&sap, &arena, &updatePairCount);
+		updatePairsTime += bench_seconds() - start;
+		uint64_t updateHash = pairs_hash(updatePairs, updatePairCount);
+
+		start = bench_seconds();
+		SweepAndPrune rebuilt = build_sap(&arena, entities, entityCount);
+		rebuildTime += bench_seconds() - start;
+
+		start = bench_seconds();
+		uint32_t rebuildPairCount;
+		BvhPair *rebuildPairs = sap_self_pairs(&rebuilt, &arena, &rebuildPairCount);
+		rebuildPairsTime += bench_seconds() - start;
+		assert(rebuildPairCount == updatePairCount && pairs_hash(rebuildPairs, rebuildPairCount) == updateHash);
+
+		start = bench_seconds();
+		for (uint32_t i = 0; i < entityCount; i++) {
+			aabbs[i] = entities[i].ab;
+		}
+		Bvh bvh = build_bvh(&arena, aabbs, entityCount);
+		bvhTime += bench_seconds() - start;
+
+		start = bench_seconds();
+		uint32_t bvhPairCount;
+		BvhPair *bvhPairs = bvh_self_pairs(&bvh, &arena, &bvhPairCount);
+		bvhPairsTime += bench_seconds() - start;
+		assert(bvhPairCount == updatePairCount && pairs_hash(bvhPairs, bvhPairCount) == updateHash);
+
+		pairTotal += updatePairCount;
+		temp_end(temp);
+	}
+
+	printf("%u entities, %u frames, times are per frame, %.1f overlapping aabbs per entity\n",
+		entityCount, frameCount, (double)pairTotal / frameCount / entityCount);
+	printf("sap_update    sort %7.2fms  pairs %7.2fms  moved %.2f places per entity\n",
+		updateTime * 1e3 / frameCount, updatePairsTime * 1e3 / frameCount, (double)swaps / frameCount / entityCount);
+	printf("build_sap     sort %7.2fms  pairs %7.2fms\n", rebuildTime * 1e3 / frameCount, rebuildPairsTime * 1e3 / frameCount);
+	printf("build_bvh    build %7.2fms  pairs %7.2fms\n", bvhTime * 1e3 / frameCount, bvhPairsTime * 1e3 / frameCount);
+
+	// the collisions of every entity in the last frame, the same collisions, only in a different order
+	TempMark temp = temp_begin(&arena);
+	Bvh bvh = build_bvh(&arena, aabbs, entityCount);
+	uint32_t *touched = alloc(&arena, entityCount, uint32_t);
+	uint32_t *nodeStack = alloc(&arena, bvh.nodeCount, uint32_t);
+
+	uint64_t bvhCollisions = 0, bvhHash = 0;
+	double start = bench_seconds();
+	for (uint32_t i = 0; i < entityCount; i++) {
+		uint32_t count;
+		uint32_t *collisions = collide_entity(&arena, &bvh, entities, i, touched, nodeStack, &count);
+		bvhCollisions += count;
+		for (uint32_t j = 0; j < count; j++) {
+			bvhHash += pair_hash(i, collisions[j]);
+		}
+	}
+	double bvhCollideTime = bench_seconds() - start;
+
+	uint64_t sapCollisions = 0, sapHash = 0;
+	start = bench_seconds();
+	for (uint32_t i = 0; i < entityCount; i++) {
+		uint32_t count;
+		uint32_t *collisions = sap_collide_entity(&arena, &sap, entities, i, touched, &count);
+		sapCollisions += count;
+		for (uint32_t j = 0; j < count; j++) {
+			sapHash += pair_hash(i, collisions[j]);
+		}
+	}
+	double sapCollideTime = bench_seconds() - start;
+	temp_end(temp);
+
+	printf("collide_entity %7.2fms  sap_collide_entity %7.2fms  collisions %llu\n",
+		bvhCollideTime * 1e3, sapCollideTime * 1e3, (unsigned long long)sapCollisions);
+	assert(sapCollisions == bvhCollisions && sapHash == bvhHash);
+}
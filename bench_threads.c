@@ -0,0 +1,133 @@
+#pragma clang diagnostic ignored "-Wlanguage-extension-token"
+#pragma clang diagnostic ignored "-Wc++20-designator"
+#pragma clang diagnostic ignored "-Wc99-extensions"
+
+#include "arenas.c"
+#include "stuff.c"
+#include "bench.c"
+#include "threads.c"
+#include "collisions.c"
+
+// finds the collisions of every entity with 1, 2, 4, ... threads and checks that all runs agree
+// once as an array per entity with find_all_collisions, once as one CollisionTable with find_all_collisions_table
+
+// usage: bench_threads [entityCount] [maxThreads]
+
+// a hash over all collision lists in entity order, equal hashes mean equal results
+uint64_t hash_collisions(uint32_t entityCount, uint32_t **entityCollisions, uint32_t *entityCollisionsCounts) {
+	uint64_t hash = 14695981039346656037ull;
+	for (uint32_t i = 0; i < entityCount; i++) {
+		hash = (hash ^ entityCollisionsCounts[i]) * 1099511628211ull;
+		for (uint32_t j = 0; j < entityCollisionsCounts[i]; j++) {
+			hash = (hash ^ entityCollisions[i][j]) * 1099511628211ull;
+		}
+	}
+	return hash;
+}
+
+// the same hash for a table
+uint64_t hash_collision_table(CollisionTable *table) {
+	uint64_t hash = 14695981039346656037ull;
+	for (uint32_t i = 0; i < table->entityCount; i++) {
+		hash = (hash ^ (table->offsets[i + 1] - table->offsets[i])) * 1099511628211ull;
+		for (uint32_t j = table->offsets[i]; j < table->offsets[i + 1]; j++) {
+			hash = (hash ^ table->ids[j]) * 1099511628211ull;
+		}
+	}
+	return hash;
+}
+
+// find_all_collisions joins a worker arena back that may have split off arenas of its own,
+// after that the parent must not take their pages for committed ones, neither after a clear nor after a shrink
+void check_nested_join(bool clear) {
+	Arena parent = arena_create(GB(1));
+	char *mark = parent.next;
+
+	Arena child = split_arena(&parent, MB(64));
+	Arena grandchild = split_arena(&child, MB(32));
+	(void)grandchild;
+	*(arena_push_type(&child, char)) = 1;
+	arena_join(&parent, &child);
+
+	if (clear) {
+		arena_clear(&parent);
+	}
+	else {
+		arena_shrink_to_pointer(&parent, mark);
+	}
+
+	// reaches into the grandchilds range, which nobody ever committed
+	char *bytes = alloc(&parent, MB(40), char);
+	memset(bytes, 1, MB(40));
+	os_release(parent.start, parent.end - parent.start);
+}
+
+int main(int argc, char **argv) {
+	check_nested_join(true);
+	check_nested_join(false);
+
+	uint32_t entityCount = bench_arg(argc, argv, 1, 1 << 20);
+	uint32_t maxThreads = bench_arg(argc, argv, 2, hardware_thread_count());
+	if (maxThreads > MAX_THREADS) {
+		maxThreads = MAX_THREADS;
+	}
+
+	Arena arena = arena_create(GB(1024));
+
+	srand(1);
+	Bvh bvh = init_bvh(&arena);
+	Entity *entities = create_random_entities_with_radius(&arena, &bvh, entityCount, radius_for_density(entityCount));
+
+	uint32_t **entityCollisions = alloc(&arena, entityCount, uint32_t*);
+	uint32_t *entityCollisionsCounts = alloc(&arena, entityCount, uint32_t);
+	char *resultsStart = arena.next;
+
+	printf("%u entities, up to %u threads\n", entityCount, maxThreads);
+	if (hardware_thread_count() < maxThreads) {
+		printf("this machine runs %u threads at once, the runs with more threads dont tell how this scales\n", hardware_thread_count());
+	}
+
+	double singleTime = 0;
+	uint64_t singleHash = 0;
+	uint32_t threadCount = 1;
+	while (1) {
+		double start = bench_seconds();
+		find_all_collisions(&arena, &bvh, entities, entityCount, threadCount, entityCollisions, entityCollisionsCounts);
+		double time = bench_seconds() - start;
+
+		// reading all results once, the way anything downstream would
+		start = bench_seconds();
+		uint64_t hash = hash_collisions(entityCount, entityCollisions, entityCollisionsCounts);
+		double readTime = bench_seconds() - start;
+		if (threadCount == 1) {
+			singleTime = time;
+			singleHash = hash;
+		}
+
+		printf("%3u threads  %8.3fs  speedup %6.2f  read %6.2fms  hash %016llx arrays %s\n",
+			threadCount, time, singleTime / time, readTime * 1e3, (unsigned long long)hash, hash == singleHash ? "" : "MISMATCH");
+		assert(hash == singleHash);
+
+		arena_shrink_to_pointer(&arena, resultsStart);
+
+		start = bench_seconds();
+		CollisionTable table = find_all_collisions_table(&arena, &bvh, entities, entityCount, threadCount);
+		double tableTime = bench_seconds() - start;
+
+		start = bench_seconds();
+		uint64_t tableHash = hash_collision_table(&table);
+		double tableReadTime = bench_seconds() - start;
+
+		printf("%3u threads  %8.3fs  speedup %6.2f  read %6.2fms  hash %016llx table  %s\n",
+			threadCount, tableTime, singleTime / tableTime, tableReadTime * 1e3, (unsigned long long)tableHash, tableHash == singleHash ? "" : "MISMATCH");
+		assert(tableHash == singleHash);
+
+		arena_shrink_to_pointer(&arena, resultsStart);
+
+		// doubling, but the last run always uses maxThreads
+		if (threadCount == maxThreads) {
+			break;
+		}
+		threadCount = (threadCount * 2 < maxThreads) ? threadCount * 2 : maxThreads;
+	}
+}
@@ -0,0 +1,115 @@
+#pragma clang diagnostic ignored "-Wlanguage-extension-token"
+#pragma clang diagnostic ignored "-Wc++20-designator"
+#pragma clang diagnostic ignored "-Wc99-extensions"
+
+#include "arenas.c"
+#include "stuff.c"
+#include "bench.c"
+#include "threads.c"
+#include "collisions.c"
+#include "bvh_build.c"
+
+// every colliding pair once, handed to a consumer that only counts and hashes them, like damage events that are applied and forgotten.
+// four ways: all collision arrays kept like find_all_collisions does, the arrays freed after every entity,
+// the visitor with a callback, and the same loop inline with for_each_collision.
+// bytes is how far the arena grew at most, all four have to see the same pairs
+
+// usage: bench_visit [entityCount]
+
+typedef struct PairSink {
+	uint64_t count;
+	uint64_t hash;
+} PairSink;
+
+void sink_pair(PairSink *sink, uint32_t a, uint32_t b) {
+	sink->count++;
+	sink->hash += (((uint64_t)a << 32) | b) * 0x9e3779b97f4a7c15ull;
+}
+
+void sink_visitor(void *data, uint32_t id, uint32_t other) {
+	sink_pair((PairSink*)data, id, other);
+}
+
+void print_visit(const char *name, double time, size_t bytes, PairSink sink, PairSink expected) {
+	printf("%-24s %8.3fs  arena %10.2fMB  pairs %llu\n", name, time, bytes / (double)MB(1), (unsigned long long)sink.count);
+	assert(sink.count == expected.count && sink.hash == expected.hash);
+}
+
+int main(int argc, char **argv) {
+	uint32_t entityCount = bench_arg(argc, argv, 1, 1 << 20);
+
+	Arena arena = arena_create(GB(1024));
+
+	srand(1);
+	Entity *entities = random_entities(&arena, entityCount, radius_for_density(entityCount));
+	AABB *aabbs = alloc(&arena, entityCount, AABB);
+	for (uint32_t i = 0; i < entityCount; i++) {
+		aabbs[i] = entities[i].ab;
+	}
+	Bvh bvh = build_bvh(&arena, aabbs, entityCount);
+	printf("%u entities\n", entityCount);
+
+	// every array kept until the end, the query buffers included
+	TempMark temp = temp_begin(&arena);
+	PairSink kept = {0};
+	double start = bench_seconds();
+	uint32_t *touched = alloc(&arena, bvh.leavesCount, uint32_t);
+	uint32_t *nodeStack = alloc(&arena, bvh.nodeCount, uint32_t);
+	uint32_t **entityCollisions = alloc(&arena, entityCount, uint32_t*);
+	uint32_t *entityCollisionsCounts = alloc(&arena, entityCount, uint32_t);
+	for (uint32_t i = 0; i < entityCount; i++) {
+		entityCollisions[i] = collide_entity(&arena, &bvh, entities, i, touched, nodeStack, entityCollisionsCounts + i);
+	}
+	for (uint32_t i = 0; i < entityCount; i++) {
+		for (uint32_t j = 0; j < entityCollisionsCounts[i]; j++) {
+			if (i < entityCollisions[i][j]) {
+				sink_pair(&kept, i, entityCollisions[i][j]);
+			}
+		}
+	}
+	double time = bench_seconds() - start;
+	print_visit("arrays kept", time, arena.next - temp.next, kept, kept);
+	temp_end(temp);
+
+	// every array consumed and freed right away, only the query buffers and the biggest array stay
+	PairSink freed = {0};
+	size_t freedBytes = 0;
+	start = bench_seconds();
+	touched = alloc(&arena, bvh.leavesCount, uint32_t);
+	nodeStack = alloc(&arena, bvh.nodeCount, uint32_t);
+	for (uint32_t i = 0; i < entityCount; i++) {
+		TempMark entityTemp = temp_begin(&arena);
+		uint32_t count;
+		uint32_t *collisions = collide_entity(&arena, &bvh, entities, i, touched, nodeStack, &count);
+		for (uint32_t j = 0; j < count; j++) {
+			if (i < collisions[j]) {
+				sink_pair(&freed, i, collisions[j]);
+			}
+		}
+		if ((size_t)(arena.next - temp.next) > freedBytes) {
+			freedBytes = arena.next - temp.next;
+		}
+		temp_end(entityTemp);
+	}
+	time = bench_seconds() - start;
+	print_visit("arrays freed", time, freedBytes, freed, kept);
+	temp_end(temp);
+
+	PairSink visited = {0};
+	start = bench_seconds();
+	visit_all_collisions(&bvh, entities, entityCount, sink_visitor, &visited);
+	time = bench_seconds() - start;
+	print_visit("visit_all_collisions", time, arena.next - temp.next, visited, kept);
+
+	PairSink inlined = {0};
+	start = bench_seconds();
+	for (uint32_t i = 0; i < entityCount; i++) {
+		for_each_collision(it, &bvh, entities, i) {
+			if (i < it.other) {
+				sink_pair(&inlined, i, it.other);
+			}
+		}
+	}
+	time = bench_seconds() - start;
+	print_visit("for_each_collision", time, arena.next - temp.next, inlined, kept);
+}
@@ -0,0 +1,367 @@
+#pragma clang diagnostic ignored "-Wlanguage-extension-token"
+#pragma clang diagnostic ignored "-Wc++20-designator"
+#pragma clang diagnostic ignored "-Wc99-extensions"
+
+#include "arenas.c"
+#include "stuff.c"
+#include "bench.c"
+#include "bvh_build.c"
+#include "bvh_wide.c"
+#include "bvh_quantized.c"
+
+// the same queries on the binary bvh from build_bvh, on the 4 and 8-wide bvhs collapsed from it and on the quantized 4-wide ones
+// all of them have to touch the same leaves, only in a different order
+// the quantized ones return a few extra candidates, so every query checks its candidates against the entity aabbs, for all of them
+// the 8-wide kernels are also checked against the scalar one on many small random scenes, they have to return the very same array
+
+// usage: bench_wide [entityCount] [queryCount]
+
+typedef struct WideResult {
+	double time;
+	uint64_t candidates;
+	uint64_t touched;
+	uint64_t identifierSum;
+	uint64_t visited;
+} WideResult;
+
+// the traversals again, but counting the nodes they pop, kept out of the timed versions
+uint64_t count_binary_visits(Bvh *bvh, AABB aabb, uint32_t *nodeStack) {
+	uint64_t visited = 0;
+	uint32_t stackCount = 1;
+	nodeStack[0] = bvh->root;
+
+	while (stackCount > 0) {
+		Node *candidate = bvh->nodes + nodeStack[--stackCount];
+		visited++;
+		if (aabb_intersects_aabb(candidate->aabb, aabb) && !is_leaf(candidate)) {
+			nodeStack[stackCount++] = candidate->right;
+			nodeStack[stackCount++] = candidate->left;
+		}
+	}
+	return visited;
+}
+
+uint64_t count_bvh8_visits(Bvh8 *bvh, AABB aabb, uint32_t *nodeStack) {
+	uint64_t visited = 0;
+	uint32_t stackCount = 1;
+	nodeStack[0] = 0;
+
+	while (stackCount > 0) {
+		Bvh8Node *node = bvh->nodes + nodeStack[--stackCount];
+		visited++;
+		for (uint32_t lane = 0; lane < 8; lane++) {
+			bool hit = node->minX[lane] <= aabb.max.x && node->maxX[lane] >= aabb.min.x
+				&& node->minY[lane] <= aabb.max.y && node->maxY[lane] >= aabb.min.y
+				&& node->minZ[lane] <= aabb.max.z && node->maxZ[lane] >= aabb.min.z;
+			if (hit && !(node->children[lane] & BVH_WIDE_LEAF)) {
+				nodeStack[stackCount++] = node->children[lane];
+			}
+		}
+	}
+	return visited;
+}
+
+uint64_t count_bvh4q8_visits(Bvh4Q8 *bvh, AABB aabb, uint32_t *nodeStack) {
+	uint64_t visited = 0;
+	uint32_t stackCount = 1;
+	nodeStack[0] = 0;
+
+	while (stackCount > 0) {
+		Bvh4Q8Node *node = bvh->nodes + nodeStack[--stackCount];
+		visited++;
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			if (bvh4q8_lane_hits(node, lane, aabb) && !(node->children[lane] & BVH_WIDE_LEAF)) {
+				nodeStack[stackCount++] = node->children[lane];
+			}
+		}
+	}
+	return visited;
+}
+
+uint64_t count_bvh4q16_visits(Bvh4Q16 *bvh, AABB aabb, uint32_t *nodeStack) {
+	uint64_t visited = 0;
+	uint32_t stackCount = 1;
+	nodeStack[0] = 0;
+
+	while (stackCount > 0) {
+		Bvh4Q16Node *node = bvh->nodes + nodeStack[--stackCount];
+		visited++;
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			if (bvh4q16_lane_hits(node, lane, aabb) && !(node->children[lane] & BVH_WIDE_LEAF)) {
+				nodeStack[stackCount++] = node->children[lane];
+			}
+		}
+	}
+	return visited;
+}
+
+uint64_t count_bvh4_visits(Bvh4 *bvh, AABB aabb, uint32_t *nodeStack) {
+	uint64_t visited = 0;
+	uint32_t stackCount = 1;
+	nodeStack[0] = 0;
+
+	while (stackCount > 0) {
+		Bvh4Node *node = bvh->nodes + nodeStack[--stackCount];
+		visited++;
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			bool hit = node->minX[lane] <= aabb.max.x && node->maxX[lane] >= aabb.min.x
+				&& node->minY[lane] <= aabb.max.y && node->maxY[lane] >= aabb.min.y
+				&& node->minZ[lane] <= aabb.max.z && node->maxZ[lane] >= aabb.min.z;
+			if (hit && !(node->children[lane] & BVH_WIDE_LEAF)) {
+				nodeStack[stackCount++] = node->children[lane];
+			}
+		}
+	}
+	return visited;
+}
+
+typedef uint32_t QueryFunction(void *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack);
+
+// every query goes through a function with exactly this type, calling them through a cast to it would be undefined
+uint32_t binary_query(void *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	return bvh_query(bvh, aabb, touched, nodeStack);
+}
+
+// these dont need the stack
+uint32_t stackless_query(void *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	(void)nodeStack;
+	return bvh_query_stackless(bvh, aabb, touched);
+}
+
+uint32_t short_stack_query(void *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	(void)nodeStack;
+	return bvh_query_short_stack(bvh, aabb, touched);
+}
+
+uint32_t wide_scalar_query(void *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	return bvh4_query_scalar(bvh, aabb, touched, nodeStack);
+}
+
+uint32_t wide_query(void *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	return bvh4_query(bvh, aabb, touched, nodeStack);
+}
+
+uint32_t wide16_scalar_query(void *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	return bvh4q16_query_scalar(bvh, aabb, touched, nodeStack);
+}
+
+uint32_t wide16_query(void *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	return bvh4q16_query(bvh, aabb, touched, nodeStack);
+}
+
+uint32_t wide8_scalar_query(void *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	return bvh4q8_query_scalar(bvh, aabb, touched, nodeStack);
+}
+
+uint32_t wide8_query(void *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	return bvh4q8_query(bvh, aabb, touched, nodeStack);
+}
+
+uint32_t wider_scalar_query(void *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	return bvh8_query_scalar(bvh, aabb, touched, nodeStack);
+}
+
+// the 8-wide kernels are picked at runtime, so the kernel comes along with the bvh
+typedef struct Bvh8Kernel {
+	Bvh8 *bvh;
+	Bvh8QueryFunction *query;
+} Bvh8Kernel;
+
+uint32_t wider_kernel_query(void *data, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	Bvh8Kernel *kernel = data;
+	return kernel->query(kernel->bvh, aabb, touched, nodeStack);
+}
+
+WideResult run(QueryFunction *query, void *bvh, Entity *entities, uint32_t entityCount, uint32_t queryCount,
+		uint32_t *touched, uint32_t *nodeStack) {
+	WideResult result = {0};
+
+	srand(2);
+	double start = bench_seconds();
+	for (uint32_t i = 0; i < queryCount; i++) {
+		uint32_t id = (uint32_t)(((uint64_t)rand() * RAND_MAX + rand()) % entityCount);
+		uint32_t touchedCount = query(bvh, entities[id].ab, touched, nodeStack);
+		result.candidates += touchedCount;
+		for (uint32_t j = 0; j < touchedCount; j++) {
+			if (aabb_intersects_aabb(entities[touched[j]].ab, entities[id].ab)) {
+				result.touched++;
+				result.identifierSum += touched[j];
+			}
+		}
+	}
+	result.time = bench_seconds() - start;
+	return result;
+}
+
+void print_result(const char *name, WideResult result, uint32_t queryCount) {
+	printf("%-16s %8.3fs  %7.3fus/query  nodes visited/query %8.2f  touched %llu  extra candidates %5.2f%%\n",
+		name, result.time, result.time * 1e6 / queryCount, (double)result.visited / queryCount, (unsigned long long)result.touched,
+		100.0 * (result.candidates - result.touched) / result.touched);
+}
+
+// random scenes of random sizes, with entities of very different sizes, some of them on top of each other, and random query boxes
+// every kernel has to return exactly what the scalar one returns
+void compare_kernels(Arena *arena, Bvh8QueryFunction **kernels, const char **names, uint32_t kernelCount) {
+	uint64_t queries = 0;
+	for (uint32_t scene = 0; scene < 200; scene++) {
+		TempMark temp = temp_begin(arena);
+		srand(1000 + scene);
+
+		uint32_t entityCount = 1 + rand() % 3000;
+		Entity *entities = random_entities(arena, entityCount, random_float());
+		for (uint32_t i = 1; i < entityCount; i += 7) {
+			entities[i] = entities[i - 1];
+		}
+
+		AABB *aabbs = alloc(arena, entityCount, AABB);
+		for (uint32_t i = 0; i < entityCount; i++) {
+			aabbs[i] = entities[i].ab;
+		}
+
+		Bvh bvh = build_bvh(arena, aabbs, entityCount);
+		Bvh8 wide = collapse_bvh8(arena, &bvh);
+		uint32_t *expected = alloc(arena, entityCount + 8, uint32_t);
+		uint32_t *touched = alloc(arena, entityCount + 8, uint32_t);
+		uint32_t *nodeStack = alloc(arena, 7 * wide.nodeCount + 8, uint32_t);
+
+		for (uint32_t q = 0; q < 100; q++) {
+			Vector center = random_vector();
+			float size = random_float() * random_float();
+			AABB query = { subf(center, size), addf(center, size * random_float()) };
+
+			uint32_t expectedCount = bvh8_query_scalar(&wide, query, expected, nodeStack);
+			for (uint32_t k = 0; k < kernelCount; k++) {
+				uint32_t touchedCount = kernels[k](&wide, query, touched, nodeStack);
+				if (touchedCount != expectedCount || memcmp(touched, expected, touchedCount * sizeof(uint32_t)) != 0) {
+					printf("%s differs from scalar in scene %u query %u, %u ids instead of %u\n", names[k], scene, q, touchedCount, expectedCount);
+					fflush(stdout);
+					assert(0);
+				}
+			}
+			queries++;
+		}
+
+		temp_end(temp);
+	}
+	printf("%u kernels returned the same as bvh8 scalar for %llu queries in 200 random scenes\n", kernelCount, (unsigned long long)queries);
+}
+
+int main(int argc, char **argv) {
+	uint32_t entityCount = bench_arg(argc, argv, 1, 1 << 20);
+	uint32_t queryCount = bench_arg(argc, argv, 2, 1 << 16);
+
+	Arena arena = arena_create(GB(1024));
+
+	Bvh8QueryFunction *kernels[3];
+	const char *names[3];
+	uint32_t kernelCount = 0;
+#if BVH_WIDE_SSE
+	build_bvh8_compact_table();
+	if (cpu_has_avx2()) {
+		kernels[kernelCount] = bvh8_query_avx2;
+		names[kernelCount++] = "bvh8 avx2";
+	}
+	if (cpu_has_avx512()) {
+		kernels[kernelCount] = bvh8_query_avx512;
+		names[kernelCount++] = "bvh8 avx512";
+	}
+#endif
+	kernels[kernelCount] = bvh8_query;
+	names[kernelCount++] = "bvh8";
+	compare_kernels(&arena, kernels, names, kernelCount);
+
+	srand(1);
+	Entity *entities = random_entities(&arena, entityCount, radius_for_density(entityCount));
+	AABB *aabbs = alloc(&arena, entityCount, AABB);
+	for (uint32_t i = 0; i < entityCount; i++) {
+		aabbs[i] = entities[i].ab;
+	}
+
+	Bvh bvh = build_bvh(&arena, aabbs, entityCount);
+	Bvh4 wide = collapse_bvh4(&arena, &bvh);
+	Bvh8 wider = collapse_bvh8(&arena, &bvh);
+	Bvh4Q16 wide16 = quantize_bvh4_16(&arena, &wide);
+	Bvh4Q8 wide8 = quantize_bvh4_8(&arena, &wide);
+	printf("%u entities, %u random queries\n", entityCount, queryCount);
+	printf("binary           %8u nodes %4zu bytes each %8.2fMB\n", bvh.nodeCount, sizeof(Node), (double)bvh.nodeCount * sizeof(Node) / MB(1));
+	printf("bvh4             %8u nodes %4zu bytes each %8.2fMB\n", wide.nodeCount, sizeof(Bvh4Node), (double)wide.nodeCount * sizeof(Bvh4Node) / MB(1));
+	printf("bvh4 q16         %8u nodes %4zu bytes each %8.2fMB\n", wide16.nodeCount, sizeof(Bvh4Q16Node), (double)wide16.nodeCount * sizeof(Bvh4Q16Node) / MB(1));
+	printf("bvh4 q8          %8u nodes %4zu bytes each %8.2fMB\n", wide8.nodeCount, sizeof(Bvh4Q8Node), (double)wide8.nodeCount * sizeof(Bvh4Q8Node) / MB(1));
+	printf("bvh8             %8u nodes %4zu bytes each %8.2fMB\n", wider.nodeCount, sizeof(Bvh8Node), (double)wider.nodeCount * sizeof(Bvh8Node) / MB(1));
+
+	uint32_t *touched = alloc(&arena, entityCount + 8, uint32_t);
+	uint32_t *nodeStack = alloc(&arena, 7 * bvh.nodeCount + 8, uint32_t);
+
+	// the traversals without a stack go the same way as bvh_query, so they have to return the very same array
+	uint32_t *expected = alloc(&arena, entityCount, uint32_t);
+	for (uint32_t i = 0; i < entityCount; i += entityCount / 1000 + 1) {
+		uint32_t expectedCount = bvh_query(&bvh, entities[i].ab, expected, nodeStack);
+		uint32_t touchedCount = bvh_query_stackless(&bvh, entities[i].ab, touched);
+		assert(touchedCount == expectedCount && memcmp(touched, expected, touchedCount * sizeof(uint32_t)) == 0);
+		touchedCount = bvh_query_short_stack(&bvh, entities[i].ab, touched);
+		assert(touchedCount == expectedCount && memcmp(touched, expected, touchedCount * sizeof(uint32_t)) == 0);
+	}
+
+	WideResult binary = run(binary_query, &bvh, entities, entityCount, queryCount, touched, nodeStack);
+	WideResult stackless = run(stackless_query, &bvh, entities, entityCount, queryCount, touched, nodeStack);
+	WideResult shortStack = run(short_stack_query, &bvh, entities, entityCount, queryCount, touched, nodeStack);
+	WideResult scalar = run(wide_scalar_query, &wide, entities, entityCount, queryCount, touched, nodeStack);
+	WideResult simd = run(wide_query, &wide, entities, entityCount, queryCount, touched, nodeStack);
+	WideResult scalar16 = run(wide16_scalar_query, &wide16, entities, entityCount, queryCount, touched, nodeStack);
+	WideResult simd16 = run(wide16_query, &wide16, entities, entityCount, queryCount, touched, nodeStack);
+	WideResult scalarQ8 = run(wide8_scalar_query, &wide8, entities, entityCount, queryCount, touched, nodeStack);
+	WideResult simdQ8 = run(wide8_query, &wide8, entities, entityCount, queryCount, touched, nodeStack);
+	WideResult scalar8 = run(wider_scalar_query, &wider, entities, entityCount, queryCount, touched, nodeStack);
+	WideResult simd8[3];
+	for (uint32_t k = 0; k < kernelCount; k++) {
+		Bvh8Kernel kernel = { &wider, kernels[k] };
+		simd8[k] = run(wider_kernel_query, &kernel, entities, entityCount, queryCount, touched, nodeStack);
+	}
+
+	srand(2);
+	for (uint32_t i = 0; i < queryCount; i++) {
+		uint32_t id = (uint32_t)(((uint64_t)rand() * RAND_MAX + rand()) % entityCount);
+		binary.visited += count_binary_visits(&bvh, entities[id].ab, nodeStack);
+		scalar.visited += count_bvh4_visits(&wide, entities[id].ab, nodeStack);
+		scalar16.visited += count_bvh4q16_visits(&wide16, entities[id].ab, nodeStack);
+		scalarQ8.visited += count_bvh4q8_visits(&wide8, entities[id].ab, nodeStack);
+		scalar8.visited += count_bvh8_visits(&wider, entities[id].ab, nodeStack);
+	}
+	simd.visited = scalar.visited;
+	stackless.visited = shortStack.visited = binary.visited;
+	simd16.visited = scalar16.visited;
+	simdQ8.visited = scalarQ8.visited;
+
+	print_result("binary", binary, queryCount);
+	print_result("binary no stack", stackless, queryCount);
+	print_result("binary 16 stack", shortStack, queryCount);
+	print_result("bvh4 scalar", scalar, queryCount);
+#if BVH_WIDE_SSE
+	print_result("bvh4 sse", simd, queryCount);
+#else
+	print_result("bvh4", simd, queryCount);
+#endif
+	print_result("bvh4 q16 scalar", scalar16, queryCount);
+	print_result("bvh4 q16", simd16, queryCount);
+	print_result("bvh4 q8 scalar", scalarQ8, queryCount);
+	print_result("bvh4 q8", simdQ8, queryCount);
+	print_result("bvh8 scalar", scalar8, queryCount);
+	for (uint32_t k = 0; k < kernelCount; k++) {
+		simd8[k].visited = scalar8.visited;
+		print_result(names[k], simd8[k], queryCount);
+		assert(scalar8.touched == simd8[k].touched && scalar8.identifierSum == simd8[k].identifierSum);
+	}
+
+	assert(binary.touched == scalar.touched && binary.identifierSum == scalar.identifierSum);
+	assert(binary.candidates == stackless.candidates && binary.identifierSum == stackless.identifierSum);
+	assert(binary.candidates == shortStack.candidates && binary.identifierSum == shortStack.identifierSum);
+	assert(scalar.touched == simd.touched && scalar.identifierSum == simd.identifierSum);
+	assert(binary.touched == scalar8.touched && binary.identifierSum == scalar8.identifierSum);
+
+	// rounding outwards may only add candidates, never lose one
+	WideResult quantized[] = { scalar16, simd16, scalarQ8, simdQ8 };
+	for (int i = 0; i < 4; i++) {
+		assert(binary.touched == quantized[i].touched && binary.identifierSum == quantized[i].identifierSum);
+	}
+	assert(scalar16.candidates == simd16.candidates && scalarQ8.candidates == simdQ8.candidates);
+}
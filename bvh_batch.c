@@ -0,0 +1,88 @@
+// many queries at once, sharing one traversal
+// include after arenas.c and stuff.c
+
+// querying every entity one by one reads the top of the tree again for every single query.
+// here up to 64 queries go down the tree together as a packet, every node on the stack carries a mask of the queries still interested in it.
+// a node is read once for the whole packet and each query in the mask is tested against it, the ones that miss drop out of the mask,
+// when nobody is left the subtree is skipped. that only pays off when the queries of a packet are close to each other,
+// so the caller should sort them, for example along a morton curve, random queries share little more than the root.
+// be aware that sorted queries are much faster one by one too, the nodes the next query needs are still in the cache,
+// so most of what a batch saves comes from the order, bench_batch measures both.
+//
+// the packet goes down the tree in the same order as bvh_query, so every query gets exactly the array bvh_query would return.
+
+#define QUERY_PACKET 64
+
+typedef struct PacketEntry {
+	uint32_t nodeId;
+	uint64_t mask;
+} PacketEntry;
+
+typedef struct PacketHit {
+	uint32_t query;
+	uint32_t identifier;
+} PacketHit;
+
+// touched[i] gets the identifiers of the leaves queries[i] touches, touchedCounts[i] how many
+// the arrays are pushed onto arena, every query gets its own, one after another in query order
+void bvh_query_batch(Bvh *bvh, Arena *arena, const AABB *queries, uint32_t queryCount, uint32_t **touched, uint32_t *touchedCounts) {
+	TempMark scratch = scratch_begin_avoiding(arena);
+	PacketEntry *stack = alloc(scratch.arena, bvh->nodeCount, PacketEntry);
+
+	for (uint32_t first = 0; first < queryCount; first += QUERY_PACKET) {
+		uint32_t packetCount = (queryCount - first < QUERY_PACKET) ? queryCount - first : QUERY_PACKET;
+		const AABB *packet = queries + first;
+		uint32_t counts[QUERY_PACKET] = {0};
+
+		// the hits of the whole packet in the order we find them, sorted into the queries afterwards
+		PacketHit *hits = begin_aligned(scratch.arena, PacketHit);
+		uint32_t hitCount = 0;
+
+		uint32_t stackCount = 0;
+		if (bvh->root != 0) {
+			stack[stackCount++] = (PacketEntry){ bvh->root, (packetCount == 64) ? ~0ull : (1ull << packetCount) - 1 };
+		}
+
+		while (stackCount > 0) {
+			PacketEntry entry = stack[--stackCount];
+			Node *node = bvh->nodes + entry.nodeId;
+
+			uint64_t mask = 0;
+			for (uint64_t remaining = entry.mask; remaining; remaining &= remaining - 1) {
+				uint32_t q = (uint32_t)__builtin_ctzll(remaining);
+				if (aabb_intersects_aabb(node->aabb, packet[q])) {
+					mask |= 1ull << q;
+				}
+			}
+			if (mask == 0) {
+				continue;
+			}
+
+			if (is_leaf(node)) {
+				for (; mask; mask &= mask - 1) {
+					uint32_t q = (uint32_t)__builtin_ctzll(mask);
+					*(arena_push_type(scratch.arena, PacketHit)) = (PacketHit){ q, node->identifier };
+					hitCount++;
+					counts[q]++;
+				}
+			}
+			else {
+				stack[stackCount++] = (PacketEntry){ node->right, mask };
+				stack[stackCount++] = (PacketEntry){ node->left, mask };
+			}
+		}
+
+		for (uint32_t q = 0; q < packetCount; q++) {
+			touched[first + q] = alloc(arena, counts[q], uint32_t);
+			touchedCounts[first + q] = 0;
+		}
+		for (uint32_t i = 0; i < hitCount; i++) {
+			uint32_t q = hits[i].query;
+			touched[first + q][touchedCounts[first + q]++] = hits[i].identifier;
+		}
+
+		arena_shrink_to_pointer(scratch.arena, hits);
+	}
+
+	scratch_end(scratch);
+}
@@ -0,0 +1,205 @@
+// building the whole bvh at once instead of inserting one leaf at a time
+// include after arenas.c and stuff.c
+
+// insert_node has to guess where a leaf goes, only knowing what was inserted before it.
+// when all leaves are known up front we can split them top-down instead, every split chosen with the surface area heuristic (SAH):
+// the cost of a split is area(left) * count(left) + area(right) * count(right), lower is better.
+// trying every possible split is too slow, so the centroids get sorted into a few bins per axis and we only try the bin borders.
+// the result is the same layout insert_node produces; node 0 is the NULL node, every leaf holds exactly one identifier.
+// so every query function works on it unchanged, and insert_node can keep adding to it afterwards.
+
+#define SAH_BINS 16
+
+typedef struct SahBin {
+	AABB aabb;
+	uint32_t count;
+} SahBin;
+
+// the leaves get shuffled around while we partition them, so they carry their aabb with them
+// that way every pass over a range reads memory front to back
+typedef struct BuildRef {
+	AABB aabb;
+	uint32_t id;
+} BuildRef;
+
+typedef struct BuildTask {
+	uint32_t nodeId;
+	uint32_t first;
+	uint32_t count;
+} BuildTask;
+
+AABB aabb_empty(void) {
+	return (AABB){ { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+}
+
+float vector_axis(Vector v, int axis) {
+	return (axis == 0) ? v.x : (axis == 1) ? v.y : v.z;
+}
+
+Vector aabb_center(AABB aabb) {
+	return mulf(add(aabb.min, aabb.max), 0.5f);
+}
+
+// finds the cheapest bin border and moves everything left of it to the front of refs
+// returns how many ended up on the left, or 0 when the centroids cant be told apart
+// half of all ranges hold only two or three leaves, they dont need 16 bins, that would cost more than the binning itself
+uint32_t sah_partition(BuildRef *refs, uint32_t count, AABB centroidBounds) {
+	int binCount = (count < SAH_BINS) ? (int)count : SAH_BINS;
+	Vector extent = sub(centroidBounds.max, centroidBounds.min);
+	Vector scale = {
+		(extent.x > 0.0f) ? (float)binCount / extent.x : 0.0f,
+		(extent.y > 0.0f) ? (float)binCount / extent.y : 0.0f,
+		(extent.z > 0.0f) ? (float)binCount / extent.z : 0.0f,
+	};
+
+	// all three axes are binned in the same pass, so every ref is only read once
+	SahBin bins[3][SAH_BINS];
+	for (int axis = 0; axis < 3; axis++) {
+		for (int b = 0; b < binCount; b++) {
+			bins[axis][b] = (SahBin){ .aabb = aabb_empty() };
+		}
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		AABB aabb = refs[i].aabb;
+		Vector offset = sub(aabb_center(aabb), centroidBounds.min);
+		for (int axis = 0; axis < 3; axis++) {
+			int b = (int)(vector_axis(offset, axis) * vector_axis(scale, axis));
+			if (b > binCount - 1) b = binCount - 1;
+			bins[axis][b].count++;
+			bins[axis][b].aabb = aabb_merge(bins[axis][b].aabb, aabb);
+		}
+	}
+
+	int bestAxis = -1;
+	int bestBorder = 0;
+	float bestCost = FLT_MAX;
+
+	for (int axis = 0; axis < 3; axis++) {
+		if (vector_axis(scale, axis) == 0.0f) {
+			continue;
+		}
+
+		// sweep from the right once to know the cost of everything right of each border
+		float rightCost[SAH_BINS];
+		AABB right = aabb_empty();
+		uint32_t rightCount = 0;
+		for (int b = binCount - 1; b > 0; b--) {
+			right = aabb_merge(right, bins[axis][b].aabb);
+			rightCount += bins[axis][b].count;
+			rightCost[b] = rightCount ? aabb_surface_area(right) * (float)rightCount : 0.0f;
+		}
+
+		AABB left = aabb_empty();
+		uint32_t leftCount = 0;
+		for (int border = 1; border < binCount; border++) {
+			left = aabb_merge(left, bins[axis][border - 1].aabb);
+			leftCount += bins[axis][border - 1].count;
+			if (leftCount == 0 || leftCount == count) {
+				continue;
+			}
+
+			float cost = aabb_surface_area(left) * (float)leftCount + rightCost[border];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestBorder = border;
+			}
+		}
+	}
+
+	if (bestAxis < 0) {
+		return 0;
+	}
+
+	float low = vector_axis(centroidBounds.min, bestAxis);
+	float axisScale = vector_axis(scale, bestAxis);
+
+	uint32_t i = 0;
+	uint32_t j = count;
+	while (i < j) {
+		int b = (int)((vector_axis(aabb_center(refs[i].aabb), bestAxis) - low) * axisScale);
+		if (b > binCount - 1) b = binCount - 1;
+
+		if (b < bestBorder) {
+			i++;
+		}
+		else {
+			j--;
+			BuildRef swap = refs[i];
+			refs[i] = refs[j];
+			refs[j] = swap;
+		}
+	}
+
+	return i;
+}
+
+// builds a bvh over count aabbs, leaf i gets identifier i
+// the nodes go into a fresh bvh split off from arena like init_bvh does, everything else lives in a scratch arena
+Bvh build_bvh(Arena *arena, const AABB *aabbs, uint32_t count) {
+	Bvh bvh = init_bvh(arena);
+	if (count == 0) {
+		return bvh;
+	}
+
+	TempMark scratch = scratch_begin_avoiding(arena);
+	BuildRef *refs = alloc(scratch.arena, count, BuildRef);
+	BuildTask *tasks = alloc(scratch.arena, count, BuildTask);
+
+	for (uint32_t i = 0; i < count; i++) {
+		refs[i] = (BuildRef){ .aabb = aabbs[i], .id = i };
+	}
+
+	// n leaves need n - 1 inner nodes
+	alloc(&bvh.arena, 2 * count - 1, Node);
+	Node *nodes = bvh.nodes;
+	bvh.root = bvh.nodeCount;
+	bvh.nodeCount += 2 * count - 1;
+	bvh.leavesCount = count;
+
+	uint32_t nextNode = bvh.root + 1;
+	uint32_t taskCount = 1;
+	tasks[0] = (BuildTask){ .nodeId = bvh.root, .first = 0, .count = count };
+	nodes[bvh.root].parent = 0;
+
+	while (taskCount > 0) {
+		BuildTask task = tasks[--taskCount];
+		Node *node = nodes + task.nodeId;
+		BuildRef *taskRefs = refs + task.first;
+
+		if (task.count == 1) {
+			*node = (Node){ .aabb = taskRefs[0].aabb, .parent = node->parent, .identifier = taskRefs[0].id };
+			continue;
+		}
+
+		AABB bounds = aabb_empty();
+		AABB centroidBounds = aabb_empty();
+		for (uint32_t i = 0; i < task.count; i++) {
+			bounds = aabb_merge(bounds, taskRefs[i].aabb);
+			Vector c = aabb_center(taskRefs[i].aabb);
+			centroidBounds = aabb_merge(centroidBounds, (AABB){ c, c });
+		}
+
+		// two leaves can only be split one way
+		uint32_t leftCount = (task.count == 2) ? 1 : sah_partition(taskRefs, task.count, centroidBounds);
+		if (leftCount == 0) {
+			// all centroids in the same spot, any split is as good as another
+			leftCount = task.count / 2;
+		}
+
+		uint32_t leftId = nextNode++;
+		uint32_t rightId = nextNode++;
+		*node = (Node){ .aabb = bounds, .parent = node->parent, .left = leftId, .right = rightId };
+		nodes[leftId].parent = task.nodeId;
+		nodes[rightId].parent = task.nodeId;
+
+		// the left side is built first
+		tasks[taskCount++] = (BuildTask){ .nodeId = rightId, .first = task.first + leftCount, .count = task.count - leftCount };
+		tasks[taskCount++] = (BuildTask){ .nodeId = leftId, .first = task.first, .count = leftCount };
+	}
+
+	assert(nextNode == bvh.nodeCount);
+	scratch_end(scratch);
+	return bvh;
+}
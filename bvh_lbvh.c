@@ -0,0 +1,264 @@
+// a linear bvh (LBVH), built in a few passes over all leaves and on all cores
+// include after arenas.c, stuff.c, threads.c and bvh_build.c
+
+// every leaf gets a morton code: its center quantized to 21 bits per axis, with the bits of x, y and z interleaved.
+// sorting by that code lays the leaves out along a z-order curve, close leaves end up close in the array.
+// after sorting, the tree is already decided; an inner node splits its range where the highest differing bit of the codes changes.
+// Karras (Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees) showed that every inner node
+// can find its own range and split without looking at any other node, so all of them are built at the same time.
+// the bounds are then filled in bottom up; the second thread that arrives at a node merges its children and continues upwards.
+// the tree is worse than the SAH build, but it only takes a few linear passes.
+
+// the result is the usual layout, node 0 is NULL, nodes 1 .. n-1 are the inner nodes with the root at 1, n .. 2n-1 are the leaves
+
+#define MORTON_BITS 21
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+typedef struct LbvhJob {
+	const AABB *aabbs;
+	uint32_t count;
+	uint32_t threadCount;
+	Barrier barrier;
+
+	Node *nodes;
+	AABB *threadBounds;
+	uint64_t *keys;
+	uint64_t *keysSwap;
+	uint32_t *ids;
+	uint32_t *idsSwap;
+	uint32_t *histograms;
+	uint32_t *visits;
+} LbvhJob;
+
+// spreads the lowest 21 bits out so there are two zero bits between each of them
+uint64_t morton_spread(uint64_t v) {
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffffull;
+	v = (v | v << 16) & 0x1f0000ff0000ffull;
+	v = (v | v << 8) & 0x100f00f00f00f00full;
+	v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+	v = (v | v << 2) & 0x1249249249249249ull;
+	return v;
+}
+
+uint64_t morton_code(Vector p, AABB bounds) {
+	float cells = (float)((1 << MORTON_BITS) - 1);
+	Vector extent = sub(bounds.max, bounds.min);
+	Vector offset = sub(p, bounds.min);
+
+	uint64_t x = (extent.x > 0.0f) ? (uint64_t)(offset.x / extent.x * cells) : 0;
+	uint64_t y = (extent.y > 0.0f) ? (uint64_t)(offset.y / extent.y * cells) : 0;
+	uint64_t z = (extent.z > 0.0f) ? (uint64_t)(offset.z / extent.z * cells) : 0;
+	return (morton_spread(x) << 2) | (morton_spread(y) << 1) | morton_spread(z);
+}
+
+// length of the common prefix of the codes at i and j, -1 when j is outside of the array
+// equal codes fall back to comparing the indices, so every key is unique
+int lbvh_delta(uint64_t *keys, uint32_t count, int64_t i, int64_t j) {
+	if (j < 0 || j >= (int64_t)count) {
+		return -1;
+	}
+	if (keys[i] == keys[j]) {
+		return 64 + __builtin_clz((uint32_t)i ^ (uint32_t)j);
+	}
+	return __builtin_clzll(keys[i] ^ keys[j]);
+}
+
+// the range of leaves [first, last) thread threadIndex works on
+void lbvh_slice(uint32_t count, uint32_t threadCount, uint32_t threadIndex, uint32_t *first, uint32_t *last) {
+	*first = (uint32_t)((uint64_t)count * threadIndex / threadCount);
+	*last = (uint32_t)((uint64_t)count * (threadIndex + 1) / threadCount);
+}
+
+void lbvh_inner_node(LbvhJob *job, uint64_t *keys, int64_t i) {
+	uint32_t count = job->count;
+	uint32_t leafBase = count;
+
+	// which way does the range go, towards the neighbour we share more bits with
+	int d = (lbvh_delta(keys, count, i, i + 1) - lbvh_delta(keys, count, i, i - 1)) >= 0 ? 1 : -1;
+	int deltaMin = lbvh_delta(keys, count, i, i - d);
+
+	// find the other end, first by doubling and then by binary search
+	int64_t lengthMax = 2;
+	while (lbvh_delta(keys, count, i, i + lengthMax * d) > deltaMin) {
+		lengthMax *= 2;
+	}
+	int64_t length = 0;
+	for (int64_t t = lengthMax / 2; t >= 1; t /= 2) {
+		if (lbvh_delta(keys, count, i, i + (length + t) * d) > deltaMin) {
+			length += t;
+		}
+	}
+	int64_t j = i + length * d;
+
+	// the split is where the prefix of the whole range ends
+	int deltaNode = lbvh_delta(keys, count, i, j);
+	int64_t split = 0;
+	int64_t t = length;
+	do {
+		t = (t + 1) / 2;
+		if (lbvh_delta(keys, count, i, i + (split + t) * d) > deltaNode) {
+			split += t;
+		}
+	} while (t > 1);
+	int64_t gamma = i + split * d + (d < 0 ? -1 : 0);
+
+	int64_t first = (i < j) ? i : j;
+	int64_t last = (i < j) ? j : i;
+	uint32_t left = (first == gamma) ? leafBase + (uint32_t)gamma : 1 + (uint32_t)gamma;
+	uint32_t right = (last == gamma + 1) ? leafBase + (uint32_t)gamma + 1 : 1 + (uint32_t)gamma + 1;
+
+	uint32_t nodeId = 1 + (uint32_t)i;
+	Node *node = job->nodes + nodeId;
+	node->left = left;
+	node->right = right;
+	node->identifier = 0;
+	job->nodes[left].parent = nodeId;
+	job->nodes[right].parent = nodeId;
+}
+
+void lbvh_worker(void *data, uint32_t threadIndex) {
+	LbvhJob *job = (LbvhJob*)data;
+	uint32_t count = job->count;
+	uint32_t first, last;
+	lbvh_slice(count, job->threadCount, threadIndex, &first, &last);
+
+	// 1. bounds of all centers
+	AABB bounds = aabb_empty();
+	for (uint32_t i = first; i < last; i++) {
+		Vector c = aabb_center(job->aabbs[i]);
+		bounds = aabb_merge(bounds, (AABB){ c, c });
+	}
+	job->threadBounds[threadIndex] = bounds;
+	barrier_wait(&job->barrier);
+
+	bounds = aabb_empty();
+	for (uint32_t t = 0; t < job->threadCount; t++) {
+		bounds = aabb_merge(bounds, job->threadBounds[t]);
+	}
+
+	// 2. morton codes
+	for (uint32_t i = first; i < last; i++) {
+		job->keys[i] = morton_code(aabb_center(job->aabbs[i]), bounds);
+		job->ids[i] = i;
+	}
+	barrier_wait(&job->barrier);
+
+	// 3. radix sort, every thread counts the digits in its slice, then scatters its slice behind everything
+	//    with a smaller digit and everything with the same digit from threads before it, so the sort is stable
+	//    every thread swaps its own copy of the buffer pointers, they all end up pointing the same way
+	uint64_t *keys = job->keys;
+	uint64_t *keysSwap = job->keysSwap;
+	uint32_t *ids = job->ids;
+	uint32_t *idsSwap = job->idsSwap;
+
+	for (uint32_t shift = 0; shift < 3 * MORTON_BITS; shift += RADIX_BITS) {
+		uint32_t *histogram = job->histograms + threadIndex * RADIX_BUCKETS;
+		memset(histogram, 0, RADIX_BUCKETS * sizeof(uint32_t));
+		for (uint32_t i = first; i < last; i++) {
+			histogram[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+		}
+		barrier_wait(&job->barrier);
+
+		uint32_t offsets[RADIX_BUCKETS];
+		uint32_t offset = 0;
+		bool allSame = false;
+		for (uint32_t digit = 0; digit < RADIX_BUCKETS; digit++) {
+			uint32_t total = 0;
+			for (uint32_t t = 0; t < job->threadCount; t++) {
+				if (t == threadIndex) {
+					offsets[digit] = offset + total;
+				}
+				total += job->histograms[t * RADIX_BUCKETS + digit];
+			}
+			offset += total;
+			allSame |= (total == count);
+		}
+
+		// every thread sees the same totals, so they all skip together
+		if (!allSame) {
+			for (uint32_t i = first; i < last; i++) {
+				uint64_t key = keys[i];
+				uint32_t target = offsets[(key >> shift) & (RADIX_BUCKETS - 1)]++;
+				keysSwap[target] = key;
+				idsSwap[target] = ids[i];
+			}
+
+			uint64_t *swapKeys = keys;
+			keys = keysSwap;
+			keysSwap = swapKeys;
+			uint32_t *swapIds = ids;
+			ids = idsSwap;
+			idsSwap = swapIds;
+		}
+
+		// nobody may overwrite its histogram before everyone is done reading them
+		barrier_wait(&job->barrier);
+	}
+
+	// 4. leaves and inner nodes
+	for (uint32_t i = first; i < last; i++) {
+		uint32_t id = ids[i];
+		Node *leaf = job->nodes + count + i;
+		leaf->aabb = job->aabbs[id];
+		leaf->left = 0;
+		leaf->right = 0;
+		leaf->identifier = id;
+		if (i + 1 < count) {
+			lbvh_inner_node(job, keys, i);
+		}
+	}
+	barrier_wait(&job->barrier);
+
+	// 5. bounds, bottom up
+	for (uint32_t i = first; i < last; i++) {
+		uint32_t nodeId = job->nodes[count + i].parent;
+		while (nodeId != 0) {
+			// the first thread to get here stops, the second one knows both children are done
+			if (__atomic_fetch_add(job->visits + nodeId, 1, __ATOMIC_ACQ_REL) == 0) {
+				break;
+			}
+			Node *node = job->nodes + nodeId;
+			node->aabb = aabb_merge(job->nodes[node->left].aabb, job->nodes[node->right].aabb);
+			nodeId = node->parent;
+		}
+	}
+}
+
+// builds a bvh over count aabbs with threadCount threads, leaf i gets identifier i
+// the morton codes come from the centers of the aabbs, which for entities are their positions
+Bvh build_lbvh(Arena *arena, const AABB *aabbs, uint32_t count, uint32_t threadCount) {
+	// there is no inner node to split with less than two leaves
+	if (count < 2) {
+		return build_bvh(arena, aabbs, count);
+	}
+
+	Bvh bvh = init_bvh(arena);
+	TempMark scratch = scratch_begin_avoiding(arena);
+
+	alloc(&bvh.arena, 2 * count - 1, Node);
+	bvh.root = 1;
+	bvh.nodeCount = 2 * count;
+	bvh.leavesCount = count;
+
+	LbvhJob job = {
+		.aabbs = aabbs,
+		.count = count,
+		.threadCount = threadCount,
+		.barrier = { .threadCount = threadCount },
+		.nodes = bvh.nodes,
+		.threadBounds = alloc(scratch.arena, threadCount, AABB),
+		.keys = alloc(scratch.arena, count, uint64_t),
+		.keysSwap = alloc(scratch.arena, count, uint64_t),
+		.ids = alloc(scratch.arena, count, uint32_t),
+		.idsSwap = alloc(scratch.arena, count, uint32_t),
+		.histograms = alloc(scratch.arena, threadCount * RADIX_BUCKETS, uint32_t),
+		.visits = zalloc(scratch.arena, count, uint32_t),
+	};
+	job.nodes[bvh.root].parent = 0;
+	run_on_threads(threadCount, lbvh_worker, &job);
+
+	scratch_end(scratch);
+	return bvh;
+}
@@ -0,0 +1,378 @@
+// the 4-wide bvh again, but with every child bound stored in 8 or 16 bits instead of a float
+// include after bvh_wide.c
+
+// a Bvh4Node spends 96 of its 112 bytes on floats, with a million entities that is 50MB, far more than any cache.
+// all children of a node lie inside the node's own box, so we store that box once, as an origin and a scale per axis,
+// and every child bound as a small integer on that grid: bound = origin + q * scale.
+// rounding always goes outwards, mins down and maxs up, so a quantized box contains the real one and no hit is ever lost.
+// the price is a few extra hits, inner nodes we open for nothing and leaves whose real aabb misses the query.
+// so the ids that come out are candidates, a superset of what bvh4_query returns, the narrow phase throws the extras out anyway.
+//
+// with 8 bits a node is 64 bytes, exactly one cache line, with 16 bits it is 88 bytes.
+// there is no infinity on the grid for unused lanes, they have child 0 instead, the root is never anybodys child.
+
+// the scalar and the simd decoding both have to round after the multiply and again after the add.
+// a compiler allowed to use fma fuses the two into one rounding, gcc does that by default in gnu mode, and the rounding
+// outwards in quantize_down and quantize_up would no longer hold for the bounds the kernels see. so no contraction in this file,
+// the STDC pragma for clang, the optimize pragma for gcc, which ignores the former
+#pragma STDC FP_CONTRACT OFF
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+
+#define QUANTIZED_STEPS_8 0xffu
+#define QUANTIZED_STEPS_16 0xffffu
+
+typedef struct Bvh4Q8Node {
+	alignas(64) float origin[3];
+	float scale[3];
+	uint8_t minX[4];
+	uint8_t minY[4];
+	uint8_t minZ[4];
+	uint8_t maxX[4];
+	uint8_t maxY[4];
+	uint8_t maxZ[4];
+	uint32_t children[4];
+} Bvh4Q8Node;
+
+typedef struct Bvh4Q16Node {
+	float origin[3];
+	float scale[3];
+	uint16_t minX[4];
+	uint16_t minY[4];
+	uint16_t minZ[4];
+	uint16_t maxX[4];
+	uint16_t maxY[4];
+	uint16_t maxZ[4];
+	uint32_t children[4];
+} Bvh4Q16Node;
+
+// same node ids as the Bvh4 they were made from, the root is node 0
+typedef struct Bvh4Q8 {
+	Bvh4Q8Node *nodes;
+	uint32_t nodeCount;
+	uint32_t leavesCount;
+} Bvh4Q8;
+
+typedef struct Bvh4Q16 {
+	Bvh4Q16Node *nodes;
+	uint32_t nodeCount;
+	uint32_t leavesCount;
+} Bvh4Q16;
+
+// the simd kernels compute exactly this, a multiply and then an add, so they see the very same bounds
+float dequantize(float origin, float scale, uint32_t q) {
+	float offset = (float)q * scale;
+	return origin + offset;
+}
+
+// the largest q that decodes to value or less
+uint32_t quantize_down(float value, float origin, float scale, uint32_t steps) {
+	if (scale == 0.0f) {
+		return 0;
+	}
+	float q = floorf((value - origin) / scale);
+	uint32_t result = (q <= 0.0f) ? 0 : (q >= (float)steps) ? steps : (uint32_t)q;
+	while (result > 0 && dequantize(origin, scale, result) > value) {
+		result--;
+	}
+	return result;
+}
+
+// the smallest q that decodes to value or more
+uint32_t quantize_up(float value, float origin, float scale, uint32_t steps) {
+	if (scale == 0.0f) {
+		return 0;
+	}
+	float q = ceilf((value - origin) / scale);
+	uint32_t result = (q <= 0.0f) ? 0 : (q >= (float)steps) ? steps : (uint32_t)q;
+	while (result < steps && dequantize(origin, scale, result) < value) {
+		result++;
+	}
+	return result;
+}
+
+// the grid of one node along one axis, the last step has to reach max, the division alone can fall short of it
+void quantization_grid(float min, float max, uint32_t steps, float *origin, float *scale) {
+	*origin = min;
+	*scale = (max - min) / (float)steps;
+	while (dequantize(min, *scale, steps) < max) {
+		*scale = nextafterf(*scale, INFINITY);
+	}
+}
+
+// quantizes the lanes of one float node, q holds minX, minY, minZ, maxX, maxY, maxZ for every lane
+void quantize_node(Bvh4Node *node, uint32_t steps, float origin[3], float scale[3], uint32_t q[6][4]) {
+	const float *mins[3] = { node->minX, node->minY, node->minZ };
+	const float *maxs[3] = { node->maxX, node->maxY, node->maxZ };
+
+	for (int axis = 0; axis < 3; axis++) {
+		float low = FLT_MAX;
+		float high = -FLT_MAX;
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			if (node->children[lane] != 0) {
+				low = fminf(low, mins[axis][lane]);
+				high = fmaxf(high, maxs[axis][lane]);
+			}
+		}
+		quantization_grid(low, high, steps, origin + axis, scale + axis);
+
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			if (node->children[lane] == 0) {
+				q[axis][lane] = 0;
+				q[axis + 3][lane] = 0;
+				continue;
+			}
+			q[axis][lane] = quantize_down(mins[axis][lane], origin[axis], scale[axis], steps);
+			q[axis + 3][lane] = quantize_up(maxs[axis][lane], origin[axis], scale[axis], steps);
+		}
+	}
+}
+
+Bvh4Q8 quantize_bvh4_8(Arena *arena, Bvh4 *wide) {
+	Bvh4Q8 result = { .nodeCount = wide->nodeCount, .leavesCount = wide->leavesCount };
+	result.nodes = alloc(arena, wide->nodeCount, Bvh4Q8Node);
+
+	for (uint32_t i = 0; i < wide->nodeCount; i++) {
+		Bvh4Q8Node *node = result.nodes + i;
+		uint32_t q[6][4];
+		quantize_node(wide->nodes + i, QUANTIZED_STEPS_8, node->origin, node->scale, q);
+
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			node->minX[lane] = (uint8_t)q[0][lane];
+			node->minY[lane] = (uint8_t)q[1][lane];
+			node->minZ[lane] = (uint8_t)q[2][lane];
+			node->maxX[lane] = (uint8_t)q[3][lane];
+			node->maxY[lane] = (uint8_t)q[4][lane];
+			node->maxZ[lane] = (uint8_t)q[5][lane];
+			node->children[lane] = wide->nodes[i].children[lane];
+		}
+	}
+	return result;
+}
+
+Bvh4Q16 quantize_bvh4_16(Arena *arena, Bvh4 *wide) {
+	Bvh4Q16 result = { .nodeCount = wide->nodeCount, .leavesCount = wide->leavesCount };
+	result.nodes = alloc(arena, wide->nodeCount, Bvh4Q16Node);
+
+	for (uint32_t i = 0; i < wide->nodeCount; i++) {
+		Bvh4Q16Node *node = result.nodes + i;
+		uint32_t q[6][4];
+		quantize_node(wide->nodes + i, QUANTIZED_STEPS_16, node->origin, node->scale, q);
+
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			node->minX[lane] = (uint16_t)q[0][lane];
+			node->minY[lane] = (uint16_t)q[1][lane];
+			node->minZ[lane] = (uint16_t)q[2][lane];
+			node->maxX[lane] = (uint16_t)q[3][lane];
+			node->maxY[lane] = (uint16_t)q[4][lane];
+			node->maxZ[lane] = (uint16_t)q[5][lane];
+			node->children[lane] = wide->nodes[i].children[lane];
+		}
+	}
+	return result;
+}
+
+bool quantized_lane_hits(const float origin[3], const float scale[3], uint32_t minX, uint32_t minY, uint32_t minZ,
+		uint32_t maxX, uint32_t maxY, uint32_t maxZ, AABB aabb) {
+	return dequantize(origin[0], scale[0], minX) <= aabb.max.x && dequantize(origin[0], scale[0], maxX) >= aabb.min.x
+		&& dequantize(origin[1], scale[1], minY) <= aabb.max.y && dequantize(origin[1], scale[1], maxY) >= aabb.min.y
+		&& dequantize(origin[2], scale[2], minZ) <= aabb.max.z && dequantize(origin[2], scale[2], maxZ) >= aabb.min.z;
+}
+
+bool bvh4q8_lane_hits(Bvh4Q8Node *node, uint32_t lane, AABB aabb) {
+	return node->children[lane] != 0 && quantized_lane_hits(node->origin, node->scale,
+		node->minX[lane], node->minY[lane], node->minZ[lane], node->maxX[lane], node->maxY[lane], node->maxZ[lane], aabb);
+}
+
+bool bvh4q16_lane_hits(Bvh4Q16Node *node, uint32_t lane, AABB aabb) {
+	return node->children[lane] != 0 && quantized_lane_hits(node->origin, node->scale,
+		node->minX[lane], node->minY[lane], node->minZ[lane], node->maxX[lane], node->maxY[lane], node->maxZ[lane], aabb);
+}
+
+// touched needs room for leavesCount ids, nodeStack for 3 * nodeCount + 1, like for bvh4_query
+uint32_t bvh4q8_query_scalar(Bvh4Q8 *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	if (bvh->nodeCount == 0) {
+		return 0;
+	}
+
+	uint32_t touchedCount = 0;
+	uint32_t stackCount = 1;
+	nodeStack[0] = 0;
+
+	while (stackCount > 0) {
+		Bvh4Q8Node *node = bvh->nodes + nodeStack[--stackCount];
+
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			if (!bvh4q8_lane_hits(node, lane, aabb)) {
+				continue;
+			}
+
+			uint32_t child = node->children[lane];
+			if (child & BVH_WIDE_LEAF) {
+				touched[touchedCount++] = child & ~BVH_WIDE_LEAF;
+			}
+			else {
+				nodeStack[stackCount++] = child;
+			}
+		}
+	}
+
+	return touchedCount;
+}
+
+uint32_t bvh4q16_query_scalar(Bvh4Q16 *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	if (bvh->nodeCount == 0) {
+		return 0;
+	}
+
+	uint32_t touchedCount = 0;
+	uint32_t stackCount = 1;
+	nodeStack[0] = 0;
+
+	while (stackCount > 0) {
+		Bvh4Q16Node *node = bvh->nodes + nodeStack[--stackCount];
+
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			if (!bvh4q16_lane_hits(node, lane, aabb)) {
+				continue;
+			}
+
+			uint32_t child = node->children[lane];
+			if (child & BVH_WIDE_LEAF) {
+				touched[touchedCount++] = child & ~BVH_WIDE_LEAF;
+			}
+			else {
+				nodeStack[stackCount++] = child;
+			}
+		}
+	}
+
+	return touchedCount;
+}
+
+#if BVH_WIDE_SSE
+
+// the query, one register per bound, the same value in every lane
+typedef struct QuantizedQuery {
+	__m128 minX, minY, minZ;
+	__m128 maxX, maxY, maxZ;
+} QuantizedQuery;
+
+QuantizedQuery quantized_query(AABB aabb) {
+	return (QuantizedQuery){
+		_mm_set1_ps(aabb.min.x), _mm_set1_ps(aabb.min.y), _mm_set1_ps(aabb.min.z),
+		_mm_set1_ps(aabb.max.x), _mm_set1_ps(aabb.max.y), _mm_set1_ps(aabb.max.z),
+	};
+}
+
+// four 8 bit values, widened to four 32 bit lanes
+__m128i load_q8(const uint8_t *q) {
+	int32_t packed;
+	memcpy(&packed, q, sizeof(packed));
+	__m128i zero = _mm_setzero_si128();
+	return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+}
+
+__m128i load_q16(const uint16_t *q) {
+	return _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)q), _mm_setzero_si128());
+}
+
+__m128 dequantize_sse(__m128i q, float origin, float scale) {
+	return _mm_add_ps(_mm_set1_ps(origin), _mm_mul_ps(_mm_cvtepi32_ps(q), _mm_set1_ps(scale)));
+}
+
+// the decoded bounds against the query, lanes with child 0 are masked out
+int quantized_hit_mask(QuantizedQuery *query, const float origin[3], const float scale[3],
+		__m128i minX, __m128i minY, __m128i minZ, __m128i maxX, __m128i maxY, __m128i maxZ, const uint32_t children[4]) {
+	__m128 hitX = _mm_and_ps(_mm_cmple_ps(dequantize_sse(minX, origin[0], scale[0]), query->maxX), _mm_cmpge_ps(dequantize_sse(maxX, origin[0], scale[0]), query->minX));
+	__m128 hitY = _mm_and_ps(_mm_cmple_ps(dequantize_sse(minY, origin[1], scale[1]), query->maxY), _mm_cmpge_ps(dequantize_sse(maxY, origin[1], scale[1]), query->minY));
+	__m128 hitZ = _mm_and_ps(_mm_cmple_ps(dequantize_sse(minZ, origin[2], scale[2]), query->maxZ), _mm_cmpge_ps(dequantize_sse(maxZ, origin[2], scale[2]), query->minZ));
+	__m128 unused = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)children), _mm_setzero_si128()));
+	return _mm_movemask_ps(_mm_andnot_ps(unused, _mm_and_ps(_mm_and_ps(hitX, hitY), hitZ)));
+}
+
+uint32_t bvh4q8_query_sse(Bvh4Q8 *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	if (bvh->nodeCount == 0) {
+		return 0;
+	}
+
+	QuantizedQuery query = quantized_query(aabb);
+	uint32_t touchedCount = 0;
+	uint32_t stackCount = 1;
+	nodeStack[0] = 0;
+
+	while (stackCount > 0) {
+		Bvh4Q8Node *node = bvh->nodes + nodeStack[--stackCount];
+		int mask = quantized_hit_mask(&query, node->origin, node->scale,
+			load_q8(node->minX), load_q8(node->minY), load_q8(node->minZ),
+			load_q8(node->maxX), load_q8(node->maxY), load_q8(node->maxZ), node->children);
+
+		while (mask) {
+			int lane = __builtin_ctz(mask);
+			mask &= mask - 1;
+
+			uint32_t child = node->children[lane];
+			if (child & BVH_WIDE_LEAF) {
+				touched[touchedCount++] = child & ~BVH_WIDE_LEAF;
+			}
+			else {
+				nodeStack[stackCount++] = child;
+			}
+		}
+	}
+
+	return touchedCount;
+}
+
+uint32_t bvh4q16_query_sse(Bvh4Q16 *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	if (bvh->nodeCount == 0) {
+		return 0;
+	}
+
+	QuantizedQuery query = quantized_query(aabb);
+	uint32_t touchedCount = 0;
+	uint32_t stackCount = 1;
+	nodeStack[0] = 0;
+
+	while (stackCount > 0) {
+		Bvh4Q16Node *node = bvh->nodes + nodeStack[--stackCount];
+		int mask = quantized_hit_mask(&query, node->origin, node->scale,
+			load_q16(node->minX), load_q16(node->minY), load_q16(node->minZ),
+			load_q16(node->maxX), load_q16(node->maxY), load_q16(node->maxZ), node->children);
+
+		while (mask) {
+			int lane = __builtin_ctz(mask);
+			mask &= mask - 1;
+
+			uint32_t child = node->children[lane];
+			if (child & BVH_WIDE_LEAF) {
+				touched[touchedCount++] = child & ~BVH_WIDE_LEAF;
+			}
+			else {
+				nodeStack[stackCount++] = child;
+			}
+		}
+	}
+
+	return touchedCount;
+}
+#endif
+
+uint32_t bvh4q8_query(Bvh4Q8 *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+#if BVH_WIDE_SSE
+	return bvh4q8_query_sse(bvh, aabb, touched, nodeStack);
+#else
+	return bvh4q8_query_scalar(bvh, aabb, touched, nodeStack);
+#endif
+}
+
+uint32_t bvh4q16_query(Bvh4Q16 *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+#if BVH_WIDE_SSE
+	return bvh4q16_query_sse(bvh, aabb, touched, nodeStack);
+#else
+	return bvh4q16_query_scalar(bvh, aabb, touched, nodeStack);
+#endif
+}
+
+#pragma GCC pop_options
+#pragma STDC FP_CONTRACT ON
@@ -0,0 +1,501 @@
+// wide bvhs; every node holds the bounds of up to four children, stored per axis so one SSE compare tests all four
+// include after arenas.c and stuff.c
+
+// a binary Node costs 40 bytes and a compare per child, and a query pops every node from the stack one at a time.
+// collapsing the binary tree into a 4-ary one takes away about half of the levels, so about half of the pops,
+// and the bounds of all children are in the parent, so a node we visit is one 112 byte block instead of four scattered Nodes.
+// the SSE path only works on x86, everything else uses the scalar path, which gives exactly the same results
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define BVH_WIDE_SSE 1
+#include <immintrin.h>
+#endif
+
+// children with this bit set are leaves, the rest of the bits are the identifier
+// unused lanes have min = +inf and max = -inf, so they never intersect anything
+#define BVH_WIDE_LEAF 0x80000000u
+
+typedef struct Bvh4Node {
+	alignas(16) float minX[4];
+	float minY[4];
+	float minZ[4];
+	float maxX[4];
+	float maxY[4];
+	float maxZ[4];
+	uint32_t children[4];
+} Bvh4Node;
+
+// the root is always node 0
+typedef struct Bvh4 {
+	Bvh4Node *nodes;
+	uint32_t nodeCount;
+	uint32_t leavesCount;
+} Bvh4;
+
+typedef struct CollapseTask {
+	uint32_t binaryId;
+	uint32_t wideId;
+} CollapseTask;
+
+// takes the children of binaryId and keeps opening the largest inner one until there are four
+uint32_t collect_wide_children(Bvh *bvh, uint32_t binaryId, uint32_t *children, uint32_t width) {
+	Node *nodes = bvh->nodes;
+	Node *node = nodes + binaryId;
+	if (is_leaf(node)) {
+		children[0] = binaryId;
+		return 1;
+	}
+
+	uint32_t count = 2;
+	children[0] = node->left;
+	children[1] = node->right;
+
+	while (count < width) {
+		int best = -1;
+		float bestArea = -1.0f;
+		for (uint32_t i = 0; i < count; i++) {
+			Node *child = nodes + children[i];
+			if (!is_leaf(child) && aabb_surface_area(child->aabb) > bestArea) {
+				bestArea = aabb_surface_area(child->aabb);
+				best = (int)i;
+			}
+		}
+		if (best < 0) {
+			break;
+		}
+
+		Node *opened = nodes + children[best];
+		children[best] = opened->left;
+		children[count++] = opened->right;
+	}
+
+	return count;
+}
+
+// both wide layouts are six arrays of width floats (minX, minY, minZ, maxX, maxY, maxZ) followed by width children
+// so one function collapses into either of them; returns the nodes, which are allocated one after another from arena
+void* collapse_wide(Arena *arena, Bvh *bvh, uint32_t width, size_t nodeSize, size_t nodeAlignment, uint32_t *nodeCountOut) {
+	*nodeCountOut = 0;
+	if (bvh->root == 0) {
+		return NULL;
+	}
+
+	TempMark scratch = scratch_begin_avoiding(arena);
+	CollapseTask *tasks = alloc(scratch.arena, bvh->nodeCount, CollapseTask);
+	uint32_t taskCount = 1;
+	tasks[0] = (CollapseTask){ .binaryId = bvh->root, .wideId = 0 };
+
+	// nothing else may allocate from arena meanwhile
+	char *nodes = alloc_aligned(arena, nodeSize, nodeAlignment);
+	uint32_t nodeCount = 1;
+
+	while (taskCount > 0) {
+		CollapseTask task = tasks[--taskCount];
+
+		uint32_t children[8];
+		uint32_t count = collect_wide_children(bvh, task.binaryId, children, width);
+
+		float *lanes = (float*)(nodes + task.wideId * nodeSize);
+		uint32_t *wideChildren = (uint32_t*)(lanes + 6 * width);
+		for (uint32_t lane = 0; lane < width; lane++) {
+			if (lane >= count) {
+				lanes[0 * width + lane] = lanes[1 * width + lane] = lanes[2 * width + lane] = INFINITY;
+				lanes[3 * width + lane] = lanes[4 * width + lane] = lanes[5 * width + lane] = -INFINITY;
+				wideChildren[lane] = 0;
+				continue;
+			}
+
+			Node *child = bvh->nodes + children[lane];
+			lanes[0 * width + lane] = child->aabb.min.x;
+			lanes[1 * width + lane] = child->aabb.min.y;
+			lanes[2 * width + lane] = child->aabb.min.z;
+			lanes[3 * width + lane] = child->aabb.max.x;
+			lanes[4 * width + lane] = child->aabb.max.y;
+			lanes[5 * width + lane] = child->aabb.max.z;
+
+			if (is_leaf(child)) {
+				wideChildren[lane] = BVH_WIDE_LEAF | child->identifier;
+			}
+			else {
+				alloc_aligned(arena, nodeSize, nodeAlignment);
+				uint32_t wideId = nodeCount++;
+				wideChildren[lane] = wideId;
+				tasks[taskCount++] = (CollapseTask){ .binaryId = children[lane], .wideId = wideId };
+			}
+		}
+	}
+
+	scratch_end(scratch);
+	*nodeCountOut = nodeCount;
+	return nodes;
+}
+
+Bvh4 collapse_bvh4(Arena *arena, Bvh *bvh) {
+	Bvh4 wide = { .leavesCount = bvh->leavesCount };
+	wide.nodes = collapse_wide(arena, bvh, 4, sizeof(Bvh4Node), alignof(Bvh4Node), &wide.nodeCount);
+	return wide;
+}
+
+// touched needs room for leavesCount ids, nodeStack for 3 * nodeCount + 1
+uint32_t bvh4_query_scalar(Bvh4 *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	if (bvh->nodeCount == 0) {
+		return 0;
+	}
+
+	uint32_t touchedCount = 0;
+	uint32_t stackCount = 1;
+	nodeStack[0] = 0;
+
+	while (stackCount > 0) {
+		Bvh4Node *node = bvh->nodes + nodeStack[--stackCount];
+
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			bool hit = node->minX[lane] <= aabb.max.x && node->maxX[lane] >= aabb.min.x
+				&& node->minY[lane] <= aabb.max.y && node->maxY[lane] >= aabb.min.y
+				&& node->minZ[lane] <= aabb.max.z && node->maxZ[lane] >= aabb.min.z;
+			if (!hit) {
+				continue;
+			}
+
+			uint32_t child = node->children[lane];
+			if (child & BVH_WIDE_LEAF) {
+				touched[touchedCount++] = child & ~BVH_WIDE_LEAF;
+			}
+			else {
+				nodeStack[stackCount++] = child;
+			}
+		}
+	}
+
+	return touchedCount;
+}
+
+#if BVH_WIDE_SSE
+uint32_t bvh4_query_sse(Bvh4 *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	if (bvh->nodeCount == 0) {
+		return 0;
+	}
+
+	__m128 queryMinX = _mm_set1_ps(aabb.min.x);
+	__m128 queryMinY = _mm_set1_ps(aabb.min.y);
+	__m128 queryMinZ = _mm_set1_ps(aabb.min.z);
+	__m128 queryMaxX = _mm_set1_ps(aabb.max.x);
+	__m128 queryMaxY = _mm_set1_ps(aabb.max.y);
+	__m128 queryMaxZ = _mm_set1_ps(aabb.max.z);
+
+	uint32_t touchedCount = 0;
+	uint32_t stackCount = 1;
+	nodeStack[0] = 0;
+
+	while (stackCount > 0) {
+		Bvh4Node *node = bvh->nodes + nodeStack[--stackCount];
+
+		__m128 hitX = _mm_and_ps(_mm_cmple_ps(_mm_load_ps(node->minX), queryMaxX), _mm_cmpge_ps(_mm_load_ps(node->maxX), queryMinX));
+		__m128 hitY = _mm_and_ps(_mm_cmple_ps(_mm_load_ps(node->minY), queryMaxY), _mm_cmpge_ps(_mm_load_ps(node->maxY), queryMinY));
+		__m128 hitZ = _mm_and_ps(_mm_cmple_ps(_mm_load_ps(node->minZ), queryMaxZ), _mm_cmpge_ps(_mm_load_ps(node->maxZ), queryMinZ));
+		int mask = _mm_movemask_ps(_mm_and_ps(_mm_and_ps(hitX, hitY), hitZ));
+
+		// same lane order as the scalar version
+		while (mask) {
+			int lane = __builtin_ctz(mask);
+			mask &= mask - 1;
+
+			uint32_t child = node->children[lane];
+			if (child & BVH_WIDE_LEAF) {
+				touched[touchedCount++] = child & ~BVH_WIDE_LEAF;
+			}
+			else {
+				nodeStack[stackCount++] = child;
+			}
+		}
+	}
+
+	return touchedCount;
+}
+#endif
+
+uint32_t bvh4_query(Bvh4 *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+#if BVH_WIDE_SSE
+	return bvh4_query_sse(bvh, aabb, touched, nodeStack);
+#else
+	return bvh4_query_scalar(bvh, aabb, touched, nodeStack);
+#endif
+}
+
+// the same with eight children per node, for AVX2 and AVX-512
+// a node is 224 bytes, so three and a half cache lines, but about a third fewer levels than the 4-wide tree
+//
+// the kernel is picked once at runtime with cpuid, so the same binary runs everywhere.
+// hits are compacted without branches; the leaf bit is the sign bit, so one movemask tells leaves from inner nodes,
+// then the hit leaves and the hit inner nodes are each written packed, in lane order, behind what is already there.
+// AVX-512 has compress stores for that, for AVX2 we look up a permutation for the mask in a table.
+// the scalar version goes through the lanes in the same order, so every kernel returns exactly the same ids in the same order
+
+typedef struct Bvh8Node {
+	alignas(32) float minX[8];
+	float minY[8];
+	float minZ[8];
+	float maxX[8];
+	float maxY[8];
+	float maxZ[8];
+	uint32_t children[8];
+} Bvh8Node;
+
+typedef struct Bvh8 {
+	Bvh8Node *nodes;
+	uint32_t nodeCount;
+	uint32_t leavesCount;
+} Bvh8;
+
+Bvh8 collapse_bvh8(Arena *arena, Bvh *bvh) {
+	Bvh8 wide = { .leavesCount = bvh->leavesCount };
+	wide.nodes = collapse_wide(arena, bvh, 8, sizeof(Bvh8Node), alignof(Bvh8Node), &wide.nodeCount);
+	return wide;
+}
+
+// the simd kernels always write 8 ids, even if fewer are hit
+// so touched needs room for leavesCount + 8 ids, nodeStack for 7 * nodeCount + 8
+typedef uint32_t Bvh8QueryFunction(Bvh8 *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack);
+
+uint32_t bvh8_query_scalar(Bvh8 *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	if (bvh->nodeCount == 0) {
+		return 0;
+	}
+
+	uint32_t touchedCount = 0;
+	uint32_t stackCount = 1;
+	nodeStack[0] = 0;
+
+	while (stackCount > 0) {
+		Bvh8Node *node = bvh->nodes + nodeStack[--stackCount];
+
+		for (uint32_t lane = 0; lane < 8; lane++) {
+			bool hit = node->minX[lane] <= aabb.max.x && node->maxX[lane] >= aabb.min.x
+				&& node->minY[lane] <= aabb.max.y && node->maxY[lane] >= aabb.min.y
+				&& node->minZ[lane] <= aabb.max.z && node->maxZ[lane] >= aabb.min.z;
+			if (!hit) {
+				continue;
+			}
+
+			uint32_t child = node->children[lane];
+			if (child & BVH_WIDE_LEAF) {
+				touched[touchedCount++] = child & ~BVH_WIDE_LEAF;
+			}
+			else {
+				nodeStack[stackCount++] = child;
+			}
+		}
+	}
+
+	return touchedCount;
+}
+
+#if BVH_WIDE_SSE
+
+// for every 8 bit mask the lanes that are set, packed to the front
+uint8_t bvh8CompactTable[256][8];
+
+// 0 while nobody built the table, 1 while one thread builds it, 2 when it is ready
+uint32_t bvh8CompactTableState;
+
+// the table is written exactly once, by whoever gets here first, everyone else waits until it is done,
+// so a kernel that reads it never sees it half written, no matter how many threads call this
+void build_bvh8_compact_table(void) {
+	if (__atomic_load_n(&bvh8CompactTableState, __ATOMIC_ACQUIRE) == 2) {
+		return;
+	}
+
+	uint32_t expected = 0;
+	if (!__atomic_compare_exchange_n(&bvh8CompactTableState, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(&bvh8CompactTableState, __ATOMIC_ACQUIRE) != 2) {
+			_mm_pause();
+		}
+		return;
+	}
+
+	for (uint32_t mask = 0; mask < 256; mask++) {
+		uint32_t count = 0;
+		for (uint32_t lane = 0; lane < 8; lane++) {
+			if (mask & (1u << lane)) {
+				bvh8CompactTable[mask][count++] = (uint8_t)lane;
+			}
+		}
+		while (count < 8) {
+			bvh8CompactTable[mask][count++] = 0;
+		}
+	}
+	__atomic_store_n(&bvh8CompactTableState, 2, __ATOMIC_RELEASE);
+}
+
+__attribute__((target("avx2")))
+__m256i bvh8_compact_avx2(__m256i v, uint32_t mask) {
+	__m256i permutation = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)bvh8CompactTable[mask]));
+	return _mm256_permutevar8x32_epi32(v, permutation);
+}
+
+__attribute__((target("avx2")))
+uint32_t bvh8_query_avx2(Bvh8 *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	if (bvh->nodeCount == 0) {
+		return 0;
+	}
+
+	__m256 queryMinX = _mm256_set1_ps(aabb.min.x);
+	__m256 queryMinY = _mm256_set1_ps(aabb.min.y);
+	__m256 queryMinZ = _mm256_set1_ps(aabb.min.z);
+	__m256 queryMaxX = _mm256_set1_ps(aabb.max.x);
+	__m256 queryMaxY = _mm256_set1_ps(aabb.max.y);
+	__m256 queryMaxZ = _mm256_set1_ps(aabb.max.z);
+	__m256i identifierBits = _mm256_set1_epi32(~BVH_WIDE_LEAF);
+
+	uint32_t touchedCount = 0;
+	uint32_t stackCount = 1;
+	nodeStack[0] = 0;
+
+	while (stackCount > 0) {
+		Bvh8Node *node = bvh->nodes + nodeStack[--stackCount];
+
+		__m256 hitX = _mm256_and_ps(_mm256_cmp_ps(_mm256_load_ps(node->minX), queryMaxX, _CMP_LE_OQ), _mm256_cmp_ps(_mm256_load_ps(node->maxX), queryMinX, _CMP_GE_OQ));
+		__m256 hitY = _mm256_and_ps(_mm256_cmp_ps(_mm256_load_ps(node->minY), queryMaxY, _CMP_LE_OQ), _mm256_cmp_ps(_mm256_load_ps(node->maxY), queryMinY, _CMP_GE_OQ));
+		__m256 hitZ = _mm256_and_ps(_mm256_cmp_ps(_mm256_load_ps(node->minZ), queryMaxZ, _CMP_LE_OQ), _mm256_cmp_ps(_mm256_load_ps(node->maxZ), queryMinZ, _CMP_GE_OQ));
+		uint32_t hitMask = (uint32_t)_mm256_movemask_ps(_mm256_and_ps(_mm256_and_ps(hitX, hitY), hitZ));
+
+		__m256i children = _mm256_load_si256((__m256i*)node->children);
+		uint32_t leafMask = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(children));
+		uint32_t leafHits = hitMask & leafMask;
+		uint32_t innerHits = hitMask & ~leafMask;
+
+		_mm256_storeu_si256((__m256i*)(touched + touchedCount), bvh8_compact_avx2(_mm256_and_si256(children, identifierBits), leafHits));
+		touchedCount += (uint32_t)__builtin_popcount(leafHits);
+
+		_mm256_storeu_si256((__m256i*)(nodeStack + stackCount), bvh8_compact_avx2(children, innerHits));
+		stackCount += (uint32_t)__builtin_popcount(innerHits);
+	}
+
+	return touchedCount;
+}
+
+__attribute__((target("avx2,avx512f,avx512vl")))
+uint32_t bvh8_query_avx512(Bvh8 *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	if (bvh->nodeCount == 0) {
+		return 0;
+	}
+
+	__m256 queryMinX = _mm256_set1_ps(aabb.min.x);
+	__m256 queryMinY = _mm256_set1_ps(aabb.min.y);
+	__m256 queryMinZ = _mm256_set1_ps(aabb.min.z);
+	__m256 queryMaxX = _mm256_set1_ps(aabb.max.x);
+	__m256 queryMaxY = _mm256_set1_ps(aabb.max.y);
+	__m256 queryMaxZ = _mm256_set1_ps(aabb.max.z);
+	__m256i identifierBits = _mm256_set1_epi32(~BVH_WIDE_LEAF);
+
+	uint32_t touchedCount = 0;
+	uint32_t stackCount = 1;
+	nodeStack[0] = 0;
+
+	while (stackCount > 0) {
+		Bvh8Node *node = bvh->nodes + nodeStack[--stackCount];
+
+		// the compares write straight into mask registers, every compare only looks at the lanes the one before let through
+		__mmask8 hit = _mm256_cmp_ps_mask(_mm256_load_ps(node->minX), queryMaxX, _CMP_LE_OQ);
+		hit = _mm256_mask_cmp_ps_mask(hit, _mm256_load_ps(node->maxX), queryMinX, _CMP_GE_OQ);
+		hit = _mm256_mask_cmp_ps_mask(hit, _mm256_load_ps(node->minY), queryMaxY, _CMP_LE_OQ);
+		hit = _mm256_mask_cmp_ps_mask(hit, _mm256_load_ps(node->maxY), queryMinY, _CMP_GE_OQ);
+		hit = _mm256_mask_cmp_ps_mask(hit, _mm256_load_ps(node->minZ), queryMaxZ, _CMP_LE_OQ);
+		hit = _mm256_mask_cmp_ps_mask(hit, _mm256_load_ps(node->maxZ), queryMinZ, _CMP_GE_OQ);
+
+		__m256i children = _mm256_load_si256((__m256i*)node->children);
+		__mmask8 leaves = (__mmask8)_mm256_movemask_ps(_mm256_castsi256_ps(children));
+		__mmask8 leafHits = hit & leaves;
+		__mmask8 innerHits = hit & ~leaves;
+
+		_mm256_mask_compressstoreu_epi32(touched + touchedCount, leafHits, _mm256_and_si256(children, identifierBits));
+		touchedCount += (uint32_t)__builtin_popcount(leafHits);
+
+		_mm256_mask_compressstoreu_epi32(nodeStack + stackCount, innerHits, children);
+		stackCount += (uint32_t)__builtin_popcount(innerHits);
+	}
+
+	return touchedCount;
+}
+
+// cpuid tells us what the cpu can do, xgetbv whether the os saves the wider registers on a context switch
+#if defined(_MSC_VER)
+#include <intrin.h>
+void cpuid(int leaf, int subleaf, int registers[4]) {
+	__cpuidex(registers, leaf, subleaf);
+}
+
+uint64_t xgetbv0(void) {
+	return _xgetbv(0);
+}
+#else
+#include <cpuid.h>
+void cpuid(int leaf, int subleaf, int registers[4]) {
+	__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+}
+
+uint64_t xgetbv0(void) {
+	uint32_t low, high;
+	__asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+	return ((uint64_t)high << 32) | low;
+}
+#endif
+
+bool cpu_has_avx2(void) {
+	int registers[4];
+	cpuid(0, 0, registers);
+	if (registers[0] < 7) {
+		return false;
+	}
+
+	cpuid(1, 0, registers);
+	bool osxsave = registers[2] & (1 << 27);
+	bool avx = registers[2] & (1 << 28);
+	if (!osxsave || !avx || (xgetbv0() & 0x6) != 0x6) {
+		return false;
+	}
+
+	cpuid(7, 0, registers);
+	return registers[1] & (1 << 5);
+}
+
+bool cpu_has_avx512(void) {
+	if (!cpu_has_avx2()) {
+		return false;
+	}
+
+	int registers[4];
+	cpuid(7, 0, registers);
+	bool avx512f = registers[1] & (1 << 16);
+	bool avx512vl = registers[1] & (1u << 31);
+	return avx512f && avx512vl && (xgetbv0() & 0xe6) == 0xe6;
+}
+
+#endif
+
+// set by the first call to bvh8_query
+Bvh8QueryFunction *bvh8QueryKernel;
+
+Bvh8QueryFunction* select_bvh8_kernel(void) {
+#if BVH_WIDE_SSE
+	build_bvh8_compact_table();
+	if (cpu_has_avx512()) {
+		return bvh8_query_avx512;
+	}
+	if (cpu_has_avx2()) {
+		return bvh8_query_avx2;
+	}
+#endif
+	return bvh8_query_scalar;
+}
+
+uint32_t bvh8_query(Bvh8 *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	// threads racing here all store the same kernel, and select_bvh8_kernel only returns once the compact table is built,
+	// so no kernel can be published before the table it reads
+	Bvh8QueryFunction *kernel = __atomic_load_n(&bvh8QueryKernel, __ATOMIC_ACQUIRE);
+	if (kernel == NULL) {
+		kernel = select_bvh8_kernel();
+		__atomic_store_n(&bvh8QueryKernel, kernel, __ATOMIC_RELEASE);
+	}
+	return kernel(bvh, aabb, touched, nodeStack);
+}
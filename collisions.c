@@ -0,0 +1,460 @@
+// finding the collisions of every entity on all cores
+// include after arenas.c, stuff.c and threads.c
+
+// the bvh is only read while we query, so the threads dont need to synchronize on it at all.
+// entities are handed out in chunks through an atomic counter, whoever is done first grabs the next chunk.
+// that way a thread that hits a dense part of the scene doesnt hold everyone up.
+// every worker writes its results into its own arena, the per-entity output arrays just point into them.
+// each entity is always queried the same way, so the results dont depend on the thread count
+// find_all_collisions_table puts all of them into one flat array instead, see CollisionTable
+
+#define COLLISION_CHUNK 256
+
+typedef struct CollisionJob {
+	Bvh *bvh;
+	Entity *entities;
+	uint32_t entityCount;
+	uint32_t nextEntity;
+
+	Arena *workerArenas;
+	uint32_t **entityCollisions;
+	uint32_t *entityCollisionsCounts;
+} CollisionJob;
+
+// the same as find_collisions_for_entity in the demos, the results get pushed onto arena
+uint32_t* collide_entity(Arena *arena, Bvh *bvh, Entity *entities, uint32_t id, uint32_t *touched, uint32_t *nodeStack, uint32_t *collisionsCountOut) {
+	uint32_t touchedCount = bvh_query(bvh, entities[id].ab, touched, nodeStack);
+
+	uint32_t *collisions = begin_aligned(arena, uint32_t);
+	uint32_t collisionsCount = 0;
+
+	for (uint32_t j = 0; j < touchedCount; j++) {
+		uint32_t mayCollideId = touched[j];
+
+		if (mayCollideId == id) {
+			continue;
+		}
+
+		if (entity_collides(entities, id, mayCollideId)) {
+			collisionsCount++;
+			*(arena_push_type(arena, uint32_t)) = mayCollideId;
+		}
+	}
+
+	*collisionsCountOut = collisionsCount;
+	return collisions;
+}
+
+// collide_entity writes every leaf the query touches to touched and then reads them all again for entity_collides,
+// and the entity of each leaf is a random access into entities. the fused version does the sphere test right at the leaf
+// and only pushes real collisions. the spheres live in an array next to the nodes, indexed by node id,
+// so they are as close together as the leaves themselves. build it again whenever the tree changes
+typedef struct LeafSphere {
+	Vector center;
+	float radius;
+} LeafSphere;
+
+LeafSphere* bvh_leaf_spheres(Arena *arena, Bvh *bvh, Entity *entities) {
+	LeafSphere *spheres = zalloc(arena, bvh->nodeCount, LeafSphere);
+	for (uint32_t i = 1; i < bvh->nodeCount; i++) {
+		Node *node = bvh->nodes + i;
+		if (is_leaf(node)) {
+			Entity *entity = entities + node->identifier;
+			spheres[i] = (LeafSphere){ entity->position, entity->radius };
+		}
+	}
+	return spheres;
+}
+
+// the same collisions in the same order as collide_entity, without the touched buffer
+uint32_t* collide_entity_fused(Arena *arena, Bvh *bvh, LeafSphere *spheres, Entity *entities, uint32_t id, uint32_t *nodeStack, uint32_t *collisionsCountOut) {
+	Entity *entity = entities + id;
+	uint32_t *collisions = begin_aligned(arena, uint32_t);
+	uint32_t collisionsCount = 0;
+
+	uint32_t stackCount = 1;
+	nodeStack[0] = bvh->root;
+
+	while (stackCount > 0) {
+		uint32_t candidateId = nodeStack[--stackCount];
+		Node *candidate = bvh->nodes + candidateId;
+
+		if (!aabb_intersects_aabb(candidate->aabb, entity->ab)) {
+			continue;
+		}
+
+		if (is_leaf(candidate)) {
+			// the same float operations as entity_collides
+			LeafSphere *sphere = spheres + candidateId;
+			float distance = squarelen(sub(entity->position, sphere->center));
+			if (candidate->identifier != id && distance < square(entity->radius + sphere->radius)) {
+				collisionsCount++;
+				*(arena_push_type(arena, uint32_t)) = candidate->identifier;
+			}
+		}
+		else {
+			nodeStack[stackCount++] = candidate->right;
+			nodeStack[stackCount++] = candidate->left;
+		}
+	}
+
+	*collisionsCountOut = collisionsCount;
+	return collisions;
+}
+
+// collide_entity without storing anything: the bvh walk stops at every collision and hands it out right away.
+// it walks the tree like bvh_query_short_stack, so all the state there is fits in the iterator itself,
+// no touched list, no node stack and no arena. the collisions come in the same order as from collide_entity.
+// the loop body can go right where the collisions are needed with for_each_collision,
+// or into a function with visit_entity_collisions
+typedef struct CollisionIterator {
+	Bvh *bvh;
+	Entity *entities;
+	uint32_t id;
+	uint32_t other; // the entity id collides with, whenever collision_iterator_next returned true
+
+	// where the walk goes on, 0 when it is done, and the short stack of bvh_query_short_stack
+	uint32_t nodeId;
+	uint32_t stackTop;
+	uint32_t stackCount;
+	bool lostEntries;
+	uint32_t stack[SHORT_STACK_SIZE];
+} CollisionIterator;
+
+CollisionIterator collision_iterator(Bvh *bvh, Entity *entities, uint32_t id) {
+	return (CollisionIterator){ .bvh = bvh, .entities = entities, .id = id, .nodeId = bvh->root };
+}
+
+// done with it->nodeId and everything below it, on to the next node
+void collision_iterator_leave(CollisionIterator *it) {
+	if (it->stackCount > 0) {
+		it->stackTop = (it->stackTop + SHORT_STACK_SIZE - 1) % SHORT_STACK_SIZE;
+		it->stackCount--;
+		it->nodeId = it->stack[it->stackTop];
+	}
+	else {
+		it->nodeId = it->lostEntries ? next_right_sibling(it->bvh, it->nodeId) : 0;
+	}
+}
+
+bool collision_iterator_next(CollisionIterator *it) {
+	Bvh *bvh = it->bvh;
+	AABB aabb = it->entities[it->id].ab;
+
+	while (it->nodeId != 0) {
+		Node *node = bvh->nodes + it->nodeId;
+		if (!aabb_intersects_aabb(node->aabb, aabb)) {
+			collision_iterator_leave(it);
+			continue;
+		}
+
+		if (!is_leaf(node)) {
+			it->stack[it->stackTop] = node->right;
+			it->stackTop = (it->stackTop + 1) % SHORT_STACK_SIZE;
+			if (it->stackCount == SHORT_STACK_SIZE) {
+				it->lostEntries = true;
+			}
+			else {
+				it->stackCount++;
+			}
+			it->nodeId = node->left;
+			continue;
+		}
+
+		// moving on first, so the next call starts behind this leaf
+		uint32_t other = node->identifier;
+		collision_iterator_leave(it);
+		if (other != it->id && entity_collides(it->entities, it->id, other)) {
+			it->other = other;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// for_each_collision(it, bvh, entities, id) { ... it.other ... }
+#define for_each_collision(IT, BVH, ENTITIES, ID) \
+	for (CollisionIterator IT = collision_iterator(BVH, ENTITIES, ID); collision_iterator_next(&IT); )
+
+typedef void CollisionVisitor(void *data, uint32_t id, uint32_t other);
+
+void visit_entity_collisions(Bvh *bvh, Entity *entities, uint32_t id, CollisionVisitor *visit, void *data) {
+	for_each_collision(it, bvh, entities, id) {
+		visit(data, id, it.other);
+	}
+}
+
+// every colliding pair once, with id < other. every pair is still found from both sides, only one of them gets visited
+void visit_all_collisions(Bvh *bvh, Entity *entities, uint32_t entityCount, CollisionVisitor *visit, void *data) {
+	for (uint32_t id = 0; id < entityCount; id++) {
+		for_each_collision(it, bvh, entities, id) {
+			if (id < it.other) {
+				visit(data, id, it.other);
+			}
+		}
+	}
+}
+
+void collision_worker(void *data, uint32_t threadIndex) {
+	CollisionJob *job = (CollisionJob*)data;
+	Bvh *bvh = job->bvh;
+	Arena *arena = job->workerArenas + threadIndex;
+
+	// the query buffers are only needed while this thread runs
+	TempMark scratch = scratch_begin();
+	uint32_t *touched = alloc(scratch.arena, bvh->leavesCount, uint32_t);
+	uint32_t *nodeStack = alloc(scratch.arena, bvh->nodeCount, uint32_t);
+
+	while (1) {
+		uint32_t first = __atomic_fetch_add(&job->nextEntity, COLLISION_CHUNK, __ATOMIC_RELAXED);
+		if (first >= job->entityCount) {
+			break;
+		}
+
+		uint32_t last = first + COLLISION_CHUNK;
+		if (last > job->entityCount) {
+			last = job->entityCount;
+		}
+
+		for (uint32_t i = first; i < last; i++) {
+			job->entityCollisions[i] = collide_entity(arena, bvh, job->entities, i, touched, nodeStack, job->entityCollisionsCounts + i);
+		}
+	}
+
+	scratch_end(scratch);
+}
+
+// fills entityCollisions and entityCollisionsCounts for all entities, using threadCount threads
+// the collision arrays live in arenas split off from arena, so they stay valid until arena is shrunk below them
+void find_all_collisions(Arena *arena, Bvh *bvh, Entity *entities, uint32_t entityCount, uint32_t threadCount,
+		uint32_t **entityCollisions, uint32_t *entityCollisionsCounts) {
+	assert(threadCount >= 1 && threadCount <= MAX_THREADS);
+
+	// how much each worker needs depends on the scene, but address space is cheap
+	// so the workers get half of what the parent has left between them
+	Arena *workerArenas = alloc(arena, threadCount, Arena);
+	size_t workerSize = align_backward((uintptr_t)(arena->end - arena->next) / (2 * threadCount), PAGE_SIZE);
+	for (uint32_t i = 0; i < threadCount; i++) {
+		workerArenas[i] = split_arena(arena, workerSize);
+	}
+
+	CollisionJob job = {
+		.bvh = bvh,
+		.entities = entities,
+		.entityCount = entityCount,
+		.workerArenas = workerArenas,
+		.entityCollisions = entityCollisions,
+		.entityCollisionsCounts = entityCollisionsCounts,
+	};
+	run_on_threads(threadCount, collision_worker, &job);
+
+	// the last worker sits right below the parents next pointer, so it can be joined back
+	// the others stay split off, their unused address space comes back when the parent shrinks below them
+	arena_join(arena, workerArenas + threadCount - 1);
+}
+
+typedef struct CollisionTableJob {
+	Bvh *bvh;
+	Entity *entities;
+	Arena *arena;
+	CollisionTable *table;
+
+	// the chunks are handed out twice, once to query them and once to copy them into the table
+	uint32_t nextEntity;
+	uint32_t nextCopy;
+	// where the ids of every chunk wait in the scratch arena of the thread that queried it
+	uint32_t **chunkIds;
+	Barrier barrier;
+} CollisionTableJob;
+
+void collision_table_worker(void *data, uint32_t threadIndex) {
+	CollisionTableJob *job = (CollisionTableJob*)data;
+	CollisionTable *table = job->table;
+	Bvh *bvh = job->bvh;
+
+	// not the callers arena, thread 0 allocates the table from it while its chunks still wait in here
+	TempMark scratch = scratch_begin_avoiding(job->arena);
+	uint32_t *touched = alloc(scratch.arena, bvh->leavesCount, uint32_t);
+	uint32_t *nodeStack = alloc(scratch.arena, bvh->nodeCount, uint32_t);
+
+	// collide_entity pushes the collisions of one entity after the other, so the ids of a whole chunk end up in one piece.
+	// the counts go one further into the offsets, so summing them up turns them into the offsets in place
+	while (1) {
+		uint32_t first = __atomic_fetch_add(&job->nextEntity, COLLISION_CHUNK, __ATOMIC_RELAXED);
+		if (first >= table->entityCount) {
+			break;
+		}
+		uint32_t last = first + COLLISION_CHUNK;
+		if (last > table->entityCount) {
+			last = table->entityCount;
+		}
+
+		job->chunkIds[first / COLLISION_CHUNK] = begin_aligned(scratch.arena, uint32_t);
+		for (uint32_t i = first; i < last; i++) {
+			collide_entity(scratch.arena, bvh, job->entities, i, touched, nodeStack, table->offsets + i + 1);
+		}
+	}
+	barrier_wait(&job->barrier);
+
+	if (threadIndex == 0) {
+		table->offsets[0] = 0;
+		for (uint32_t i = 0; i < table->entityCount; i++) {
+			table->offsets[i + 1] += table->offsets[i];
+		}
+		table->ids = alloc(job->arena, table->offsets[table->entityCount], uint32_t);
+	}
+	barrier_wait(&job->barrier);
+
+	while (1) {
+		uint32_t first = __atomic_fetch_add(&job->nextCopy, COLLISION_CHUNK, __ATOMIC_RELAXED);
+		if (first >= table->entityCount) {
+			break;
+		}
+		uint32_t last = first + COLLISION_CHUNK;
+		if (last > table->entityCount) {
+			last = table->entityCount;
+		}
+		memcpy(table->ids + table->offsets[first], job->chunkIds[first / COLLISION_CHUNK], (table->offsets[last] - table->offsets[first]) * sizeof(uint32_t));
+	}
+
+	// the others may still copy out of our scratch arena
+	barrier_wait(&job->barrier);
+	scratch_end(scratch);
+}
+
+// find_all_collisions, but all results end up in one CollisionTable allocated from arena
+// every entity is queried once, each chunk collects its ids in one piece in the scratch arena of its thread, with the counts in the offsets.
+// then the counts are summed up, and with the offsets every thread knows where its chunks go in the table without waiting on anyone else
+CollisionTable find_all_collisions_table(Arena *arena, Bvh *bvh, Entity *entities, uint32_t entityCount, uint32_t threadCount) {
+	TempMark scratch = scratch_begin_avoiding(arena);
+
+	CollisionTable table = { .entityCount = entityCount, .offsets = alloc(arena, entityCount + 1, uint32_t) };
+	CollisionTableJob job = {
+		.bvh = bvh,
+		.entities = entities,
+		.arena = arena,
+		.table = &table,
+		.chunkIds = alloc(scratch.arena, (entityCount + COLLISION_CHUNK - 1) / COLLISION_CHUNK, uint32_t*),
+		.barrier = { .threadCount = threadCount },
+	};
+	run_on_threads(threadCount, collision_table_worker, &job);
+
+	scratch_end(scratch);
+	return table;
+}
+
+// querying every entity finds every pair twice, a with b and b with a, and every query starts at the root again.
+// instead we descend the tree against itself: a node pair whose boxes dont overlap is dropped with everything below it,
+// and a node against itself splits into its two children against themselves and against each other, so no pair comes up twice.
+// of two overlapping nodes the bigger one gets opened, that keeps the pairs we look at about the same size
+
+typedef struct BvhPair {
+	uint32_t a;
+	uint32_t b;
+} BvhPair;
+
+#define SELF_PAIRS_STACK 256
+
+// the pairs of one leaf with every leaf below nodeId, like bvh_query but without the pair stack, the leaf is already known to overlap nodeId
+uint32_t leaf_self_pairs(Node *nodes, Node *leaf, uint32_t nodeId, uint32_t *nodeStack, Arena *arena) {
+	AABB aabb = leaf->aabb;
+	uint32_t identifier = leaf->identifier;
+	uint32_t pairCount = 0;
+	uint32_t stackCount = 1;
+	nodeStack[0] = nodeId;
+
+	while (stackCount > 0) {
+		Node *node = nodes + nodeStack[--stackCount];
+		if (is_leaf(node)) {
+			uint32_t low = (node->identifier < identifier) ? node->identifier : identifier;
+			uint32_t high = (node->identifier < identifier) ? identifier : node->identifier;
+			*(arena_push_type(arena, BvhPair)) = (BvhPair){ low, high };
+			pairCount++;
+			continue;
+		}
+		if (aabb_intersects_aabb(nodes[node->right].aabb, aabb)) nodeStack[stackCount++] = node->right;
+		if (aabb_intersects_aabb(nodes[node->left].aabb, aabb)) nodeStack[stackCount++] = node->left;
+	}
+	return pairCount;
+}
+
+// every pair of leaves with overlapping aabbs, exactly once and with a < b, as identifiers
+// the pairs are pushed onto arena one after another, the node pairs still to look at live in a scratch arena.
+// in dense scenes most of the work is the pairs themselves, so a child is tested against the other node before it is pushed,
+// and two leaves are written out right away. what is on the stack always overlaps, or is a node against itself.
+// once one side is a leaf, the rest is a plain query of that leaf in the other subtree, see leaf_self_pairs.
+// the stack is a plain array, nothing else allocates from the scratch arena, so when it is full the next piece of the arena is right behind it
+BvhPair* bvh_self_pairs(Bvh *bvh, Arena *arena, uint32_t *pairCountOut) {
+	Node *nodes = bvh->nodes;
+	BvhPair *pairs = begin_aligned(arena, BvhPair);
+	uint32_t pairCount = 0;
+
+	TempMark scratch = scratch_begin_avoiding(arena);
+	uint32_t *nodeStack = alloc(scratch.arena, bvh->nodeCount, uint32_t);
+	uint32_t stackCapacity = SELF_PAIRS_STACK;
+	BvhPair *stack = alloc(scratch.arena, stackCapacity, BvhPair);
+	uint32_t stackCount = 0;
+	if (bvh->root != 0) {
+		stack[stackCount++] = (BvhPair){ bvh->root, bvh->root };
+	}
+
+	while (stackCount > 0) {
+		if (stackCount + 3 > stackCapacity) {
+			alloc(scratch.arena, stackCapacity, BvhPair);
+			stackCapacity *= 2;
+		}
+
+		BvhPair pair = stack[--stackCount];
+		Node *a = nodes + pair.a;
+		Node *b = nodes + pair.b;
+
+		if (pair.a == pair.b) {
+			if (is_leaf(a)) {
+				continue;
+			}
+			Node *left = nodes + a->left;
+			Node *right = nodes + a->right;
+			if (aabb_intersects_aabb(left->aabb, right->aabb)) {
+				if (is_leaf(left) && is_leaf(right)) {
+					uint32_t low = (left->identifier < right->identifier) ? left->identifier : right->identifier;
+					uint32_t high = (left->identifier < right->identifier) ? right->identifier : left->identifier;
+					*(arena_push_type(arena, BvhPair)) = (BvhPair){ low, high };
+					pairCount++;
+				}
+				else {
+					stack[stackCount++] = (BvhPair){ a->left, a->right };
+				}
+			}
+			if (!is_leaf(right)) stack[stackCount++] = (BvhPair){ a->right, a->right };
+			if (!is_leaf(left)) stack[stackCount++] = (BvhPair){ a->left, a->left };
+			continue;
+		}
+
+		if (is_leaf(a)) {
+			pairCount += leaf_self_pairs(nodes, a, pair.b, nodeStack, arena);
+			continue;
+		}
+		if (is_leaf(b)) {
+			pairCount += leaf_self_pairs(nodes, b, pair.a, nodeStack, arena);
+			continue;
+		}
+
+		// open the bigger one, the other one stays
+		Node *opened = a;
+		Node *other = b;
+		uint32_t otherId = pair.b;
+		if (aabb_surface_area(b->aabb) > aabb_surface_area(a->aabb)) {
+			opened = b;
+			other = a;
+			otherId = pair.a;
+		}
+
+		if (aabb_intersects_aabb(nodes[opened->right].aabb, other->aabb)) stack[stackCount++] = (BvhPair){ opened->right, otherId };
+		if (aabb_intersects_aabb(nodes[opened->left].aabb, other->aabb)) stack[stackCount++] = (BvhPair){ opened->left, otherId };
+	}
+
+	scratch_end(scratch);
+	*pairCountOut = pairCount;
+	return pairs;
+}
@@ -0,0 +1,198 @@
+// a uniform grid as broad phase, hashed so it needs no bounds and no memory for empty cells
+// include after arenas.c, stuff.c and collisions.c
+
+// the cells are about two average entities wide, and every entity goes into all cells its aabb covers, mostly one to eight.
+// a query only looks at the cells its own aabb covers. smaller cells put every entity into many more of them, and the query
+// walks more cells than it saves on entries, bigger cells fill up with entries that are too far away, bench_grid shows it.
+// sizing the cells for the biggest entity would make every cell hold dozens of the small ones, one big entity in a few dozen cells is much cheaper.
+// two entities can share several cells, so a pair only counts in one of them: the cell that holds the min corner of the overlap of their aabbs.
+//
+// the cells are hashed into a table of buckets, every entry remembers its cell, entries of other cells in the same bucket are skipped.
+// building is a counting sort: count the entries per bucket, sum the counts up to offsets, and copy every entry to its place.
+// the entries hold a copy of the entity, so everything one cell needs is next to each other in memory.
+//
+// that works best when all entities are about the same size, with very different sizes the bvh wins, bench_grid shows where.
+
+typedef struct GridCell {
+	int32_t x;
+	int32_t y;
+	int32_t z;
+} GridCell;
+
+typedef struct GridEntry {
+	GridCell cell;
+	uint32_t id;
+	Entity entity;
+} GridEntry;
+
+typedef struct Grid {
+	float cellSize;
+	float inverseCellSize;
+	uint32_t bucketMask;
+	uint32_t entryCount;
+
+	// the entries of bucket b are entries[bucketStart[b]] to entries[bucketStart[b + 1] - 1]
+	uint32_t *bucketStart;
+	GridEntry *entries;
+} Grid;
+
+GridCell grid_cell(Grid *grid, Vector position) {
+	return (GridCell){
+		(int32_t)floorf(position.x * grid->inverseCellSize),
+		(int32_t)floorf(position.y * grid->inverseCellSize),
+		(int32_t)floorf(position.z * grid->inverseCellSize),
+	};
+}
+
+bool grid_cell_equals(GridCell a, GridCell b) {
+	return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+uint32_t grid_bucket(Grid *grid, GridCell cell) {
+	uint32_t hash = ((uint32_t)cell.x * 73856093u) ^ ((uint32_t)cell.y * 19349663u) ^ ((uint32_t)cell.z * 83492791u);
+
+	// the low bits of the products only depend on the low bits of the coordinates, mix the high bits down before masking
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	return hash & grid->bucketMask;
+}
+
+// the cell a pair is counted in, the one with the min corner of the overlap of both aabbs, which both of them cover
+GridCell grid_pair_cell(Grid *grid, AABB a, AABB b) {
+	return grid_cell(grid, (Vector){ f_max(a.min.x, b.min.x), f_max(a.min.y, b.min.y), f_max(a.min.z, b.min.z) });
+}
+
+// everything is allocated from arena, only the entry count of every bucket is counted in place
+Grid build_grid(Arena *arena, Entity *entities, uint32_t entityCount) {
+	double radiusSum = 0.0;
+	for (uint32_t i = 0; i < entityCount; i++) {
+		radiusSum += entities[i].radius;
+	}
+
+	Grid grid = {0};
+	float meanRadius = entityCount ? (float)(radiusSum / entityCount) : 0.0f;
+	grid.cellSize = (meanRadius > 0.0f) ? 4.0f * meanRadius : 1.0f;
+	grid.inverseCellSize = 1.0f / grid.cellSize;
+
+	// the cells each entity covers, counted once to size everything
+	for (uint32_t i = 0; i < entityCount; i++) {
+		GridCell low = grid_cell(&grid, entities[i].ab.min);
+		GridCell high = grid_cell(&grid, entities[i].ab.max);
+		grid.entryCount += (uint32_t)((high.x - low.x + 1) * (high.y - low.y + 1) * (high.z - low.z + 1));
+	}
+
+	// about two buckets per entry keeps the shared ones rare
+	uint32_t bucketCount = 1;
+	while (bucketCount < 2 * grid.entryCount) {
+		bucketCount *= 2;
+	}
+	grid.bucketMask = bucketCount - 1;
+	grid.bucketStart = zalloc(arena, bucketCount + 1, uint32_t);
+	grid.entries = alloc(arena, grid.entryCount, GridEntry);
+
+	for (uint32_t i = 0; i < entityCount; i++) {
+		GridCell low = grid_cell(&grid, entities[i].ab.min);
+		GridCell high = grid_cell(&grid, entities[i].ab.max);
+		for (int32_t z = low.z; z <= high.z; z++) {
+			for (int32_t y = low.y; y <= high.y; y++) {
+				for (int32_t x = low.x; x <= high.x; x++) {
+					grid.bucketStart[grid_bucket(&grid, (GridCell){ x, y, z }) + 1]++;
+				}
+			}
+		}
+	}
+	for (uint32_t b = 0; b < bucketCount; b++) {
+		grid.bucketStart[b + 1] += grid.bucketStart[b];
+	}
+
+	// bucketStart[b] moves forward while bucket b fills up, afterwards it points at the start of bucket b + 1
+	for (uint32_t i = 0; i < entityCount; i++) {
+		GridCell low = grid_cell(&grid, entities[i].ab.min);
+		GridCell high = grid_cell(&grid, entities[i].ab.max);
+		for (int32_t z = low.z; z <= high.z; z++) {
+			for (int32_t y = low.y; y <= high.y; y++) {
+				for (int32_t x = low.x; x <= high.x; x++) {
+					GridCell cell = { x, y, z };
+					uint32_t slot = grid.bucketStart[grid_bucket(&grid, cell)]++;
+					grid.entries[slot] = (GridEntry){ .cell = cell, .id = i, .entity = entities[i] };
+				}
+			}
+		}
+	}
+	for (uint32_t b = bucketCount; b > 0; b--) {
+		grid.bucketStart[b] = grid.bucketStart[b - 1];
+	}
+	grid.bucketStart[0] = 0;
+
+	return grid;
+}
+
+// the same test as entity_collides
+bool grid_entities_collide(Entity *e, Entity *f) {
+	float distance = squarelen(sub(e->position, f->position));
+	return distance < square(e->radius + f->radius);
+}
+
+// the same as collide_entity, the collisions of entity id pushed onto arena, only in grid order instead of bvh order
+uint32_t* grid_collide_entity(Arena *arena, Grid *grid, Entity *entities, uint32_t id, uint32_t *collisionsCountOut) {
+	Entity *entity = entities + id;
+	uint32_t *collisions = begin_aligned(arena, uint32_t);
+	uint32_t collisionsCount = 0;
+
+	GridCell low = grid_cell(grid, entity->ab.min);
+	GridCell high = grid_cell(grid, entity->ab.max);
+	for (int32_t z = low.z; z <= high.z; z++) {
+		for (int32_t y = low.y; y <= high.y; y++) {
+			for (int32_t x = low.x; x <= high.x; x++) {
+				GridCell cell = { x, y, z };
+				uint32_t bucket = grid_bucket(grid, cell);
+
+				for (uint32_t slot = grid->bucketStart[bucket]; slot < grid->bucketStart[bucket + 1]; slot++) {
+					GridEntry *entry = grid->entries + slot;
+					if (!grid_cell_equals(entry->cell, cell) || entry->id == id || !grid_entities_collide(entity, &entry->entity)) {
+						continue;
+					}
+					if (grid_cell_equals(grid_pair_cell(grid, entity->ab, entry->entity.ab), cell)) {
+						*(arena_push_type(arena, uint32_t)) = entry->id;
+						collisionsCount++;
+					}
+				}
+			}
+		}
+	}
+
+	*collisionsCountOut = collisionsCount;
+	return collisions;
+}
+
+// the same as bvh_self_pairs: every pair of entities with overlapping aabbs exactly once, with a < b, pushed onto arena
+// within every bucket, every entry against the entries after it
+BvhPair* grid_self_pairs(Grid *grid, Arena *arena, uint32_t *pairCountOut) {
+	BvhPair *pairs = begin_aligned(arena, BvhPair);
+	uint32_t pairCount = 0;
+	uint32_t bucketCount = grid->bucketMask + 1;
+
+	for (uint32_t bucket = 0; bucket < bucketCount; bucket++) {
+		uint32_t end = grid->bucketStart[bucket + 1];
+		for (uint32_t slot = grid->bucketStart[bucket]; slot < end; slot++) {
+			GridEntry *entry = grid->entries + slot;
+
+			for (uint32_t other = slot + 1; other < end; other++) {
+				GridEntry *otherEntry = grid->entries + other;
+				if (!grid_cell_equals(entry->cell, otherEntry->cell) || !aabb_intersects_aabb(entry->entity.ab, otherEntry->entity.ab)) {
+					continue;
+				}
+				if (grid_cell_equals(grid_pair_cell(grid, entry->entity.ab, otherEntry->entity.ab), entry->cell)) {
+					uint32_t a = entry->id;
+					uint32_t b = otherEntry->id;
+					*(arena_push_type(arena, BvhPair)) = (a < b) ? (BvhPair){ a, b } : (BvhPair){ b, a };
+					pairCount++;
+				}
+			}
+		}
+	}
+
+	*pairCountOut = pairCount;
+	return pairs;
+}
@@ -0,0 +1,169 @@
+// the entities as a structure of arrays, and the narrow phase over them 8 or 16 candidates at a time
+// include after bvh_wide.c, the simd kernels use its cpu detection and its compaction table
+
+// entity_collides loads two whole Entity structs, 40 bytes each, to use 16 bytes of each of them, and tests one pair at a time.
+// with every coordinate in its own array a gather loads one coordinate of 8 (AVX2) or 16 (AVX-512) candidates at once,
+// and the whole test is a few multiplies and one compare for all of them. the survivors are compacted into the output like
+// bvh8_query compacts its hits. entity i is still index i in every array, so the ids the bvh returns work unchanged.
+//
+// every kernel does the same float operations in the same order as entity_collides, so they all find exactly the same collisions
+
+typedef struct EntitySoa {
+	float *x;
+	float *y;
+	float *z;
+	float *radius;
+	uint32_t count;
+} EntitySoa;
+
+EntitySoa entities_to_soa(Arena *arena, Entity *entities, uint32_t entityCount) {
+	EntitySoa soa = {
+		.x = alloc(arena, entityCount, float),
+		.y = alloc(arena, entityCount, float),
+		.z = alloc(arena, entityCount, float),
+		.radius = alloc(arena, entityCount, float),
+		.count = entityCount,
+	};
+	for (uint32_t i = 0; i < entityCount; i++) {
+		soa.x[i] = entities[i].position.x;
+		soa.y[i] = entities[i].position.y;
+		soa.z[i] = entities[i].position.z;
+		soa.radius[i] = entities[i].radius;
+	}
+	return soa;
+}
+
+bool entity_soa_collides(EntitySoa *soa, uint32_t a, uint32_t b) {
+	float dx = soa->x[a] - soa->x[b];
+	float dy = soa->y[a] - soa->y[b];
+	float dz = soa->z[a] - soa->z[b];
+	float distance = dx * dx + dy * dy + dz * dz;
+	float radius = soa->radius[a] + soa->radius[b];
+	return distance < radius * radius;
+}
+
+// writes the candidates that collide with entity id to collisions, in the order they come in, id itself is skipped
+// the AVX2 kernel always writes whole vectors, so collisions needs room for candidateCount + 8 ids
+typedef uint32_t NarrowPhaseFunction(EntitySoa *soa, uint32_t id, const uint32_t *candidates, uint32_t candidateCount, uint32_t *collisions);
+
+uint32_t narrow_phase_scalar(EntitySoa *soa, uint32_t id, const uint32_t *candidates, uint32_t candidateCount, uint32_t *collisions) {
+	uint32_t collisionsCount = 0;
+	for (uint32_t i = 0; i < candidateCount; i++) {
+		uint32_t candidate = candidates[i];
+		if (candidate != id && entity_soa_collides(soa, id, candidate)) {
+			collisions[collisionsCount++] = candidate;
+		}
+	}
+	return collisionsCount;
+}
+
+#if BVH_WIDE_SSE
+
+__attribute__((target("avx2")))
+uint32_t narrow_phase_avx2(EntitySoa *soa, uint32_t id, const uint32_t *candidates, uint32_t candidateCount, uint32_t *collisions) {
+	__m256 x = _mm256_set1_ps(soa->x[id]);
+	__m256 y = _mm256_set1_ps(soa->y[id]);
+	__m256 z = _mm256_set1_ps(soa->z[id]);
+	__m256 radius = _mm256_set1_ps(soa->radius[id]);
+	__m256i self = _mm256_set1_epi32((int)id);
+
+	// the last few candidates go through the same code with the lanes past the end masked off
+	__m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	uint32_t collisionsCount = 0;
+	for (uint32_t i = 0; i < candidateCount; i += 8) {
+		__m256i active = _mm256_cmpgt_epi32(_mm256_set1_epi32((int)(candidateCount - i)), laneIndex);
+		__m256 activeps = _mm256_castsi256_ps(active);
+		__m256 zero = _mm256_setzero_ps();
+
+		__m256i ids = _mm256_maskload_epi32((const int*)(candidates + i), active);
+		__m256 dx = _mm256_sub_ps(x, _mm256_mask_i32gather_ps(zero, soa->x, ids, activeps, 4));
+		__m256 dy = _mm256_sub_ps(y, _mm256_mask_i32gather_ps(zero, soa->y, ids, activeps, 4));
+		__m256 dz = _mm256_sub_ps(z, _mm256_mask_i32gather_ps(zero, soa->z, ids, activeps, 4));
+		__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+		__m256 radii = _mm256_add_ps(radius, _mm256_mask_i32gather_ps(zero, soa->radius, ids, activeps, 4));
+
+		__m256 hits = _mm256_and_ps(activeps, _mm256_cmp_ps(distance, _mm256_mul_ps(radii, radii), _CMP_LT_OQ));
+		uint32_t mask = (uint32_t)_mm256_movemask_ps(hits);
+		mask &= ~(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(ids, self)));
+
+		_mm256_storeu_si256((__m256i*)(collisions + collisionsCount), bvh8_compact_avx2(ids, mask));
+		collisionsCount += (uint32_t)__builtin_popcount(mask);
+	}
+
+	return collisionsCount;
+}
+
+__attribute__((target("avx2,avx512f")))
+uint32_t narrow_phase_avx512(EntitySoa *soa, uint32_t id, const uint32_t *candidates, uint32_t candidateCount, uint32_t *collisions) {
+	__m512 x = _mm512_set1_ps(soa->x[id]);
+	__m512 y = _mm512_set1_ps(soa->y[id]);
+	__m512 z = _mm512_set1_ps(soa->z[id]);
+	__m512 radius = _mm512_set1_ps(soa->radius[id]);
+	__m512i self = _mm512_set1_epi32((int)id);
+
+	// the last few candidates go through the same code with the lanes past the end masked off
+	uint32_t collisionsCount = 0;
+	for (uint32_t i = 0; i < candidateCount; i += 16) {
+		uint32_t left = candidateCount - i;
+		__mmask16 active = (left >= 16) ? (__mmask16)0xffff : (__mmask16)((1u << left) - 1);
+
+		__m512i ids = _mm512_maskz_loadu_epi32(active, candidates + i);
+		__m512 dx = _mm512_sub_ps(x, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), active, ids, soa->x, 4));
+		__m512 dy = _mm512_sub_ps(y, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), active, ids, soa->y, 4));
+		__m512 dz = _mm512_sub_ps(z, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), active, ids, soa->z, 4));
+		__m512 distance = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)), _mm512_mul_ps(dz, dz));
+		__m512 radii = _mm512_add_ps(radius, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), active, ids, soa->radius, 4));
+
+		__mmask16 hits = _mm512_mask_cmp_ps_mask(active, distance, _mm512_mul_ps(radii, radii), _CMP_LT_OQ);
+		hits &= ~_mm512_cmpeq_epi32_mask(ids, self);
+
+		_mm512_mask_compressstoreu_epi32(collisions + collisionsCount, hits, ids);
+		collisionsCount += (uint32_t)__builtin_popcount(hits);
+	}
+
+	return collisionsCount;
+}
+
+#endif
+
+// set by the first call to narrow_phase
+NarrowPhaseFunction *narrowPhaseKernel;
+
+NarrowPhaseFunction* select_narrow_phase_kernel(void) {
+#if BVH_WIDE_SSE
+	// the avx2 kernel compacts with the table of bvh_wide.c. it is only ever built once,
+	// so this never touches it when bvh8_query already built it, and other threads may keep reading it
+	build_bvh8_compact_table();
+	if (cpu_has_avx512()) {
+		return narrow_phase_avx512;
+	}
+	if (cpu_has_avx2()) {
+		return narrow_phase_avx2;
+	}
+#endif
+	return narrow_phase_scalar;
+}
+
+uint32_t narrow_phase(EntitySoa *soa, uint32_t id, const uint32_t *candidates, uint32_t candidateCount, uint32_t *collisions) {
+	// the same race as in bvh8_query, everyone stores the same kernel, and only after the compact table is built
+	NarrowPhaseFunction *kernel = __atomic_load_n(&narrowPhaseKernel, __ATOMIC_ACQUIRE);
+	if (kernel == NULL) {
+		kernel = select_narrow_phase_kernel();
+		__atomic_store_n(&narrowPhaseKernel, kernel, __ATOMIC_RELEASE);
+	}
+	return kernel(soa, id, candidates, candidateCount, collisions);
+}
+
+// collide_entity for the SoA store, the collisions are pushed onto arena
+uint32_t* collide_entity_soa(Arena *arena, Bvh *bvh, EntitySoa *soa, uint32_t id, uint32_t *touched, uint32_t *nodeStack, uint32_t *collisionsCountOut) {
+	uint32_t touchedCount = bvh_query(bvh, (AABB){ { soa->x[id] - soa->radius[id], soa->y[id] - soa->radius[id], soa->z[id] - soa->radius[id] },
+		{ soa->x[id] + soa->radius[id], soa->y[id] + soa->radius[id], soa->z[id] + soa->radius[id] } }, touched, nodeStack);
+
+	// room for what the kernel may write, then the arena gives back what it didnt need
+	uint32_t *collisions = alloc(arena, touchedCount + 8, uint32_t);
+	uint32_t collisionsCount = narrow_phase(soa, id, touched, touchedCount, collisions);
+	finish_array(arena, collisions, collisionsCount);
+
+	*collisionsCountOut = collisionsCount;
+	return collisions;
+}
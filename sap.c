@@ -0,0 +1,154 @@
+// sweep and prune as broad phase: all aabbs sorted along x, the overlaps come out of a sweep over that order
+// include after arenas.c, stuff.c and collisions.c
+
+// two aabbs can only overlap when their x intervals do. with the entries sorted by min.x, every entry only has to look at the
+// entries after it until their min.x is past its own max.x, the y and z test filters the rest. that finds every pair exactly once.
+// a query for any other aabb binary searches for the first entry that can reach it and sweeps from there the same way.
+//
+// between frames the order barely changes when things move smoothly, so sap_update doesnt sort from scratch. it fixes the
+// order with an insertion sort, every entry only moves past the few it overtook since the last frame, that is close to linear.
+// when everything jumps around it is quadratic, then build a new one with build_sap.
+//
+// the sweep only prunes along one axis, so the scans get long when many entities share the same x, a dense 3d scene is
+// the worst case. bench_sap shows how it does next to the bvh.
+
+typedef struct SweepEntry {
+	AABB ab;
+	uint32_t id;
+} SweepEntry;
+
+typedef struct SweepAndPrune {
+	SweepEntry *entries; // sorted by ab.min.x
+	uint32_t count;
+
+	// sweptMax[i] is the largest max.x of entries[0] to entries[i], so it only grows,
+	// everything before the first one that reaches a query cannot touch the query
+	float *sweptMax;
+
+	// how many places the entries moved in the last sap_update
+	uint64_t swaps;
+} SweepAndPrune;
+
+int compare_sweep_entries(const void *a, const void *b) {
+	float minA = ((const SweepEntry*)a)->ab.min.x;
+	float minB = ((const SweepEntry*)b)->ab.min.x;
+	return (minA > minB) - (minA < minB);
+}
+
+void sap_update_swept_max(SweepAndPrune *sap) {
+	float sweptMax = -INFINITY;
+	for (uint32_t i = 0; i < sap->count; i++) {
+		sweptMax = f_max(sweptMax, sap->entries[i].ab.max.x);
+		sap->sweptMax[i] = sweptMax;
+	}
+}
+
+// sorted from scratch, entity i is id i
+SweepAndPrune build_sap(Arena *arena, Entity *entities, uint32_t entityCount) {
+	SweepAndPrune sap = {
+		.entries = alloc(arena, entityCount, SweepEntry),
+		.count = entityCount,
+		.sweptMax = alloc(arena, entityCount, float),
+	};
+	for (uint32_t i = 0; i < entityCount; i++) {
+		sap.entries[i] = (SweepEntry){ entities[i].ab, i };
+	}
+	qsort(sap.entries, entityCount, sizeof(SweepEntry), compare_sweep_entries);
+	sap_update_swept_max(&sap);
+	return sap;
+}
+
+// takes the new aabbs of all entities and sorts them again
+// everything in front of entry i is already up to date and sorted, so each entry gets its new aabb and is moved back to where it belongs
+void sap_update(SweepAndPrune *sap, Entity *entities) {
+	SweepEntry *entries = sap->entries;
+	uint64_t swaps = 0;
+
+	for (uint32_t i = 0; i < sap->count; i++) {
+		SweepEntry entry = entries[i];
+		entry.ab = entities[entry.id].ab;
+
+		uint32_t j = i;
+		while (j > 0 && entries[j - 1].ab.min.x > entry.ab.min.x) {
+			entries[j] = entries[j - 1];
+			j--;
+		}
+		entries[j] = entry;
+		swaps += i - j;
+	}
+
+	sap->swaps = swaps;
+	sap_update_swept_max(sap);
+}
+
+// the same as bvh_query, the ids of all aabbs that touch aabb are written to touched, sorted along x instead of in tree order
+uint32_t sap_query(SweepAndPrune *sap, AABB aabb, uint32_t *touched) {
+	// the first entry whose swept max reaches the query, no entry before it can
+	uint32_t low = 0;
+	uint32_t high = sap->count;
+	while (low < high) {
+		uint32_t middle = low + (high - low) / 2;
+		if (sap->sweptMax[middle] < aabb.min.x) {
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+
+	uint32_t touchedCount = 0;
+	for (uint32_t i = low; i < sap->count && sap->entries[i].ab.min.x <= aabb.max.x; i++) {
+		if (aabb_intersects_aabb(sap->entries[i].ab, aabb)) {
+			touched[touchedCount++] = sap->entries[i].id;
+		}
+	}
+	return touchedCount;
+}
+
+// collide_entity with the sweep instead of the bvh, the collisions are pushed onto arena
+uint32_t* sap_collide_entity(Arena *arena, SweepAndPrune *sap, Entity *entities, uint32_t id, uint32_t *touched, uint32_t *collisionsCountOut) {
+	uint32_t touchedCount = sap_query(sap, entities[id].ab, touched);
+
+	uint32_t *collisions = begin_aligned(arena, uint32_t);
+	uint32_t collisionsCount = 0;
+
+	for (uint32_t j = 0; j < touchedCount; j++) {
+		uint32_t mayCollideId = touched[j];
+
+		if (mayCollideId == id) {
+			continue;
+		}
+
+		if (entity_collides(entities, id, mayCollideId)) {
+			collisionsCount++;
+			*(arena_push_type(arena, uint32_t)) = mayCollideId;
+		}
+	}
+
+	*collisionsCountOut = collisionsCount;
+	return collisions;
+}
+
+// the same as bvh_self_pairs: every pair of entities with overlapping aabbs exactly once, with a < b, pushed onto arena
+BvhPair* sap_self_pairs(SweepAndPrune *sap, Arena *arena, uint32_t *pairCountOut) {
+	BvhPair *pairs = begin_aligned(arena, BvhPair);
+	uint32_t pairCount = 0;
+	SweepEntry *entries = sap->entries;
+
+	for (uint32_t i = 0; i < sap->count; i++) {
+		SweepEntry *entry = entries + i;
+
+		for (uint32_t j = i + 1; j < sap->count && entries[j].ab.min.x <= entry->ab.max.x; j++) {
+			if (!aabb_intersects_aabb(entry->ab, entries[j].ab)) {
+				continue;
+			}
+			uint32_t a = entry->id;
+			uint32_t b = entries[j].id;
+			*(arena_push_type(arena, BvhPair)) = (a < b) ? (BvhPair){ a, b } : (BvhPair){ b, a };
+			pairCount++;
+		}
+	}
+
+	*pairCountOut = pairCount;
+	return pairs;
+}
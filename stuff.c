@@ -138,6 +138,15 @@ typedef struct Node {
 	uint32_t identifier;
 } Node;
 
+// to tune the margin; how often leaves have to be reinserted vs how many extra leaves queries touch
+typedef struct BvhStats {
+	uint64_t updates;
+	uint64_t reinserts;
+	uint64_t queries;
+	uint64_t touched;
+	uint64_t touchedByMargin;
+} BvhStats;
+
 typedef struct Bvh {
 	Arena arena;
 	Node *nodes;
@@ -145,6 +154,18 @@ typedef struct Bvh {
 	uint32_t root;
 	uint32_t leavesCount;
 
+	// removed nodes are chained through their parent field, push_node takes from here before growing the arena
+	uint32_t freeList;
+
+	// leaves are stored with fat bounds; margin on every side, and velocityScale times the displacement of the last update added in the direction of movement
+	// as long as the tight bounds stay inside, update_leaf leaves the tree alone. but queries touch more leaves the fatter they are
+	float margin;
+	float velocityScale;
+	BvhStats stats;
+
+	// when set, fix_upwards also rotates the tree where that makes nodes smaller, see rotate_node
+	bool rotate;
+
 	// please ignore for now
 	Arena nodeStack;
 } Bvh;
@@ -153,12 +174,83 @@ bool is_leaf(Node *node) {
 	return (node->left == 0 || node->right == 0);
 }
 
+bool aabb_equals(AABB a, AABB b) {
+	return a.min.x == b.min.x && a.min.y == b.min.y && a.min.z == b.min.z
+		&& a.max.x == b.max.x && a.max.y == b.max.y && a.max.z == b.max.z;
+}
+
+// swaps childId, a child of nodeId, with grandchildId, a child of its sibling, then refits the sibling
+void swap_with_grandchild(Bvh *b, uint32_t nodeId, uint32_t childId, uint32_t siblingId, uint32_t grandchildId) {
+	Node *nodes = b->nodes;
+	Node *node = nodes + nodeId;
+	Node *sibling = nodes + siblingId;
+
+	if (node->left == childId) node->left = grandchildId; else node->right = grandchildId;
+	if (sibling->left == grandchildId) sibling->left = childId; else sibling->right = childId;
+	nodes[grandchildId].parent = nodeId;
+	nodes[childId].parent = siblingId;
+
+	sibling->aabb = aabb_merge(nodes[sibling->left].aabb, nodes[sibling->right].aabb);
+}
+
+// inserts and removals only ever refit, so the tree keeps the shape the first leaves gave it, even when they are long gone.
+// like box2d, we look at the four ways of swapping a child of nodeId with one of its grandchildren
+// and do the one that makes the child that gets a new pair of children the smallest, if any makes it smaller at all.
+// nodeId itself keeps the same leaves, so its bounds dont change. returns whether it swapped anything
+bool rotate_node(Bvh *b, uint32_t nodeId) {
+	Node *nodes = b->nodes;
+	Node *node = nodes + nodeId;
+	if (is_leaf(node)) {
+		return false;
+	}
+
+	uint32_t leftId = node->left;
+	uint32_t rightId = node->right;
+	Node *left = nodes + leftId;
+	Node *right = nodes + rightId;
+
+	float bestGain = 0.0f;
+	uint32_t bestChild = 0, bestSibling = 0, bestGrandchild = 0;
+
+	if (!is_leaf(right)) {
+		float area = aabb_surface_area(right->aabb);
+		// left <-> right->left, right keeps right->right
+		float gain = area - aabb_surface_area(aabb_merge(left->aabb, nodes[right->right].aabb));
+		if (gain > bestGain) { bestGain = gain; bestChild = leftId; bestSibling = rightId; bestGrandchild = right->left; }
+		gain = area - aabb_surface_area(aabb_merge(left->aabb, nodes[right->left].aabb));
+		if (gain > bestGain) { bestGain = gain; bestChild = leftId; bestSibling = rightId; bestGrandchild = right->right; }
+	}
+
+	if (!is_leaf(left)) {
+		float area = aabb_surface_area(left->aabb);
+		float gain = area - aabb_surface_area(aabb_merge(right->aabb, nodes[left->right].aabb));
+		if (gain > bestGain) { bestGain = gain; bestChild = rightId; bestSibling = leftId; bestGrandchild = left->left; }
+		gain = area - aabb_surface_area(aabb_merge(right->aabb, nodes[left->left].aabb));
+		if (gain > bestGain) { bestGain = gain; bestChild = rightId; bestSibling = leftId; bestGrandchild = left->right; }
+	}
+
+	if (bestGain > 0.0f) {
+		swap_with_grandchild(b, nodeId, bestChild, bestSibling, bestGrandchild);
+		return true;
+	}
+	return false;
+}
+
+// refits the bounds of nodeId and its ancestors
+// once a node comes out the same as before and wasnt rotated, nothing above it can change either.
+// a rotation keeps the bounds of the node but changes a child, and the parent may want to rotate because of that
 void fix_upwards(Bvh *p, uint32_t nodeId) {
 	while (nodeId != 0) {
+		bool rotated = p->rotate && rotate_node(p, nodeId);
+
 		Node *node = p->nodes + nodeId;
 		Node *left = p->nodes + node->left;
 		Node *right = p->nodes + node->right;
-		node->aabb = aabb_merge(left->aabb, right->aabb);
+		AABB aabb = aabb_merge(left->aabb, right->aabb);
+		if (aabb_equals(aabb, node->aabb) && !rotated) {
+			break;
+		}
+		node->aabb = aabb;
 		nodeId = node->parent;
 	}
 }
@@ -208,24 +300,32 @@ uint32_t find_sibling_for_aabb(Bvh *b, AABB aabb) {
 }
 
 uint32_t push_node(Bvh *b) {
+	if (b->freeList != 0) {
+		uint32_t nodeId = b->freeList;
+		b->freeList = b->nodes[nodeId].parent;
+		return nodeId;
+	}
 	alloc(&b->arena, 1, Node);
 	return b->nodeCount++;
 }
 
-uint32_t insert_node(Bvh *b, uint32_t identifier, AABB aabb) {
-	b->leavesCount++;
-	Node *nodes = b->nodes;
-	Arena *arena = &b->arena;
+void free_node(Bvh *b, uint32_t nodeId) {
+	b->nodes[nodeId] = (Node){ .parent = b->freeList };
+	b->freeList = nodeId;
+}
 
-	uint32_t nodeId = push_node(b);
+// hangs a leaf that is not in the tree yet next to the best sibling for its aabb
+void link_leaf(Bvh *b, uint32_t nodeId) {
+	Node *nodes = b->nodes;
 	Node *node = nodes + nodeId;
-	*node = (Node){ .aabb = aabb, .identifier = identifier };
-	
+	node->parent = 0;
+
 	if (b->root == 0) {
 		b->root = nodeId;
-		return nodeId;
+		return;
 	}
 
+	AABB aabb = node->aabb;
 	uint32_t siblingId = find_sibling_for_aabb(b, aabb);
 	Node *sibling = nodes + siblingId;
 
@@ -256,10 +356,94 @@ uint32_t insert_node(Bvh *b, uint32_t identifier, AABB aabb) {
 		siblingParent->right = newParentId;
 	}
 
-	fix_upwards(b, newParentId);
+	// the new parent already has the right bounds, so we start with the one above
+	if (b->rotate) {
+		rotate_node(b, newParentId);
+	}
+	fix_upwards(b, siblingParentId);
+}
+
+// takes a leaf out of the tree without freeing it, its sibling takes the place of their parent
+void unlink_leaf(Bvh *b, uint32_t nodeId) {
+	Node *nodes = b->nodes;
+
+	if (b->root == nodeId) {
+		b->root = 0;
+		return;
+	}
+
+	uint32_t parentId = nodes[nodeId].parent;
+	Node *parent = nodes + parentId;
+	uint32_t siblingId = (parent->left == nodeId) ? parent->right : parent->left;
+	uint32_t grandParentId = parent->parent;
+	Node *grandParent = nodes + grandParentId;
+
+	nodes[siblingId].parent = grandParentId;
+	if (grandParentId == 0) {
+		b->root = siblingId;
+	}
+	else {
+		if (grandParent->left == parentId) {
+			grandParent->left = siblingId;
+		}
+		else {
+			grandParent->right = siblingId;
+		}
+		fix_upwards(b, grandParentId);
+	}
+
+	free_node(b, parentId);
+}
+
+AABB fatten_aabb(Bvh *b, AABB aabb, Vector displacement) {
+	AABB fat = { subf(aabb.min, b->margin), addf(aabb.max, b->margin) };
+
+	Vector predicted = mulf(displacement, b->velocityScale);
+	if (predicted.x < 0.0f) fat.min.x += predicted.x; else fat.max.x += predicted.x;
+	if (predicted.y < 0.0f) fat.min.y += predicted.y; else fat.max.y += predicted.y;
+	if (predicted.z < 0.0f) fat.min.z += predicted.z; else fat.max.z += predicted.z;
+	return fat;
+}
+
+uint32_t insert_node(Bvh *b, uint32_t identifier, AABB aabb) {
+	b->leavesCount++;
+
+	uint32_t nodeId = push_node(b);
+	b->nodes[nodeId] = (Node){ .aabb = fatten_aabb(b, aabb, (Vector){0}), .identifier = identifier };
+	link_leaf(b, nodeId);
 	return nodeId;
 }
 
+void remove_leaf(Bvh *b, uint32_t nodeId) {
+	assert(is_leaf(b->nodes + nodeId));
+	b->leavesCount--;
+
+	unlink_leaf(b, nodeId);
+	free_node(b, nodeId);
+}
+
+// the leaf keeps its node id, so whoever stored it doesnt need to update anything
+void move_leaf(Bvh *b, uint32_t nodeId, AABB aabb) {
+	assert(is_leaf(b->nodes + nodeId));
+
+	unlink_leaf(b, nodeId);
+	b->nodes[nodeId].aabb = aabb;
+	link_leaf(b, nodeId);
+}
+
+// call after an entity moved, aabb are its new tight bounds and displacement how far it moved since the last update
+// returns true when the leaf had to be reinserted
+bool update_leaf(Bvh *b, uint32_t nodeId, AABB aabb, Vector displacement) {
+	b->stats.updates++;
+	if (aabb_contains(b->nodes[nodeId].aabb, aabb)) {
+		return false;
+	}
+
+	b->stats.reinserts++;
+	move_leaf(b, nodeId, fatten_aabb(b, aabb, displacement));
+	return true;
+}
+
 Bvh init_bvh(Arena *arena) {
 
 	Bvh bvh = {0};
@@ -276,6 +460,196 @@ Bvh init_bvh(Arena *arena) {
 	return bvh;
 }
 
+// the traversal from 1_basic_problem, oblivious to the allocator
+// touched needs room for leavesCount ids and nodeStack for nodeCount ids
+uint32_t bvh_query(Bvh *bvh, AABB aabb, uint32_t *touched, uint32_t *nodeStack) {
+	uint32_t touchedCount = 0;
+	uint32_t stackCount = 1;
+	nodeStack[0] = bvh->root;
+
+	while (stackCount > 0) {
+		uint32_t candidateId = nodeStack[--stackCount];
+		Node *candidate = bvh->nodes + candidateId;
+
+		if (!aabb_intersects_aabb(candidate->aabb, aabb)) {
+			continue;
+		}
+
+		if(is_leaf(candidate)) {
+			touched[touchedCount++] = candidate->identifier;
+		}
+		else {
+			nodeStack[stackCount++] = candidate->right;
+			nodeStack[stackCount++] = candidate->left;
+		}
+	}
+
+	return touchedCount;
+}
+
+// the traversals below need no nodeStack, they find their way back up through the parent links.
+// bvh_query visits the left child first and the right one later, so when we are done with a node, what comes next is
+// the right sibling of the closest ancestor we entered from its left side; everything left of us is done, everything right is not yet.
+// returns 0 when there is no such ancestor, then the whole tree is done
+uint32_t next_right_sibling(Bvh *bvh, uint32_t nodeId) {
+	Node *nodes = bvh->nodes;
+	while (nodeId != bvh->root) {
+		uint32_t parentId = nodes[nodeId].parent;
+		if (nodes[parentId].left == nodeId) {
+			return nodes[parentId].right;
+		}
+		nodeId = parentId;
+	}
+	return 0;
+}
+
+// no stack at all, every node we leave costs a walk up to the next right sibling instead
+// touches the same leaves in the same order as bvh_query, touched needs room for leavesCount ids
+uint32_t bvh_query_stackless(Bvh *bvh, AABB aabb, uint32_t *touched) {
+	uint32_t touchedCount = 0;
+	uint32_t nodeId = bvh->root;
+
+	while (nodeId != 0) {
+		Node *node = bvh->nodes + nodeId;
+		if (aabb_intersects_aabb(node->aabb, aabb)) {
+			if (!is_leaf(node)) {
+				nodeId = node->left;
+				continue;
+			}
+			touched[touchedCount++] = node->identifier;
+		}
+		nodeId = next_right_sibling(bvh, nodeId);
+	}
+
+	return touchedCount;
+}
+
+// a stack of a few entries that lives in registers and L1, when it is full the oldest entry is overwritten
+// only when the stack runs empty after losing entries we walk up like bvh_query_stackless, to the next right sibling
+// the lost entries are always the ones closest to the root, so the walk finds exactly them, in the right order
+#define SHORT_STACK_SIZE 16
+
+uint32_t bvh_query_short_stack(Bvh *bvh, AABB aabb, uint32_t *touched) {
+	uint32_t stack[SHORT_STACK_SIZE];
+	uint32_t stackTop = 0;
+	uint32_t stackCount = 0;
+	bool lostEntries = false;
+
+	uint32_t touchedCount = 0;
+	uint32_t nodeId = bvh->root;
+
+	while (nodeId != 0) {
+		Node *node = bvh->nodes + nodeId;
+		if (aabb_intersects_aabb(node->aabb, aabb)) {
+			if (!is_leaf(node)) {
+				stack[stackTop] = node->right;
+				stackTop = (stackTop + 1) % SHORT_STACK_SIZE;
+				if (stackCount == SHORT_STACK_SIZE) {
+					lostEntries = true;
+				}
+				else {
+					stackCount++;
+				}
+				nodeId = node->left;
+				continue;
+			}
+			touched[touchedCount++] = node->identifier;
+		}
+
+		if (stackCount > 0) {
+			stackTop = (stackTop + SHORT_STACK_SIZE - 1) % SHORT_STACK_SIZE;
+			stackCount--;
+			nodeId = stack[stackTop];
+		}
+		else {
+			nodeId = lostEntries ? next_right_sibling(bvh, nodeId) : 0;
+		}
+	}
+
+	return touchedCount;
+}
+
+// the surface area heuristic cost of the whole tree, relative to the root
+// the sum of the areas of all inner nodes divided by the area of the root; the expected number of inner nodes
+// a query for a random point visits. lower is better, it only grows when the tree degrades, so it can be tracked over time
+float bvh_sah_cost(Bvh *bvh) {
+	if (bvh->root == 0 || is_leaf(bvh->nodes + bvh->root)) {
+		return 0.0f;
+	}
+
+	TempMark scratch = scratch_begin();
+	uint32_t *nodeStack = alloc(scratch.arena, bvh->nodeCount, uint32_t);
+	uint32_t stackCount = 1;
+	nodeStack[0] = bvh->root;
+
+	double area = 0.0;
+	while (stackCount > 0) {
+		Node *node = bvh->nodes + nodeStack[--stackCount];
+		if (is_leaf(node)) {
+			continue;
+		}
+		area += aabb_surface_area(node->aabb);
+		nodeStack[stackCount++] = node->left;
+		nodeStack[stackCount++] = node->right;
+	}
+
+	scratch_end(scratch);
+	return (float)(area / aabb_surface_area(bvh->nodes[bvh->root].aabb));
+}
+
+// push_node hands out ids in the order nodes are created, so after a few thousand inserts a parent and its children
+// are anywhere in the array and every step down the tree is a cache miss.
+// this lays the nodes out again in depth first order; the root is node 1 and every left child comes right after its parent,
+// so half of all steps down go to the next node, and every subtree is one contiguous block.
+// freed nodes are dropped on the way, the free list is empty afterwards.
+// every node id changes, the result maps old ids to new ones (0 for nodes that were not in the tree), it is allocated from scratch
+uint32_t* bvh_reorder(Bvh *bvh, Arena *scratch) {
+	uint32_t *newIds = zalloc(scratch, bvh->nodeCount, uint32_t);
+	if (bvh->root == 0) {
+		return newIds;
+	}
+
+	TempMark temp = temp_begin(scratch);
+	Node *oldNodes = alloc(scratch, bvh->nodeCount, Node);
+	memcpy(oldNodes, bvh->nodes, bvh->nodeCount * sizeof(Node));
+
+	// first number the nodes in the order we visit them, right is pushed first so left is popped right after its parent
+	uint32_t *nodeStack = alloc(scratch, bvh->nodeCount, uint32_t);
+	uint32_t stackCount = 1;
+	nodeStack[0] = bvh->root;
+	uint32_t nodeCount = 1;
+
+	while (stackCount > 0) {
+		uint32_t oldId = nodeStack[--stackCount];
+		Node *node = oldNodes + oldId;
+		newIds[oldId] = nodeCount++;
+		if (!is_leaf(node)) {
+			nodeStack[stackCount++] = node->right;
+			nodeStack[stackCount++] = node->left;
+		}
+	}
+
+	// then move every node to its new place, the NULL node 0 stays where it is
+	for (uint32_t oldId = 1; oldId < bvh->nodeCount; oldId++) {
+		if (newIds[oldId] == 0) {
+			continue;
+		}
+		Node node = oldNodes[oldId];
+		node.parent = newIds[node.parent];
+		node.left = newIds[node.left];
+		node.right = newIds[node.right];
+		bvh->nodes[newIds[oldId]] = node;
+	}
+
+	arena_shrink_to_pointer(&bvh->arena, bvh->nodes + nodeCount);
+	bvh->nodeCount = nodeCount;
+	bvh->root = newIds[bvh->root];
+	bvh->freeList = 0;
+
+	temp_end(temp);
+	return newIds;
+}
+
 // entities are just circles
 typedef struct Entity {
 	Vector position;
@@ -291,27 +665,59 @@ bool entity_collides(Entity *entities, uint32_t a, uint32_t b) {
 	return distance < square(e->radius + f->radius);
 }
 
+// the bvh only knows the fat bounds, so queries return leaves that the entity itself doesnt touch
+// call with what bvh_query returned to count those, entity_collides still has to check the tight bounds
+void bvh_count_query(Bvh *b, Entity *entities, AABB aabb, uint32_t *touched, uint32_t touchedCount) {
+	b->stats.queries++;
+	b->stats.touched += touchedCount;
+	for (uint32_t i = 0; i < touchedCount; i++) {
+		if (!aabb_intersects_aabb(entities[touched[i]].ab, aabb)) {
+			b->stats.touchedByMargin++;
+		}
+	}
+}
+
 void print_entity_collisions(Entity *entities, uint32_t entitiesCount, uint32_t **entityCollisions, uint32_t *entityCollisionsCount) {
-	for (int i = 0; i < entitiesCount; i++) {
+	for (uint32_t i = 0; i < entitiesCount; i++) {
 		Entity *entity = entities + i;
 
-		printf("Entity %d at (%f %f %f) with radius %f collides with:\n\t", i, entity->position.x, entity->position.y, entity->position.z, entity->radius);
-		for (int j = 0; j < entityCollisionsCount[i]; j++) {
-			printf("%d, ", entityCollisions[i][j]);
+		printf("Entity %u at (%f %f %f) with radius %f collides with:\n\t", i, entity->position.x, entity->position.y, entity->position.z, entity->radius);
+		for (uint32_t j = 0; j < entityCollisionsCount[i]; j++) {
+			printf("%u, ", entityCollisions[i][j]);
 		}
 		printf("\n");
 	}
 }
 
-Entity *create_random_entities(Arena *arena, Bvh *bvh, uint32_t entityCount) {
+// all collisions of all entities in one array, the collisions of entity i are ids[offsets[i]] to ids[offsets[i + 1] - 1]
+// two allocations in total, instead of an array for every entity plus the pointers to them
+typedef struct CollisionTable {
+	uint32_t entityCount;
+	uint32_t *offsets; // entityCount + 1 of them, the last one is how many collisions there are in total
+	uint32_t *ids;
+} CollisionTable;
+
+void print_collision_table(Entity *entities, CollisionTable *table) {
+	for (uint32_t i = 0; i < table->entityCount; i++) {
+		Entity *entity = entities + i;
+
+		printf("Entity %u at (%f %f %f) with radius %f collides with:\n\t", i, entity->position.x, entity->position.y, entity->position.z, entity->radius);
+		for (uint32_t j = table->offsets[i]; j < table->offsets[i + 1]; j++) {
+			printf("%u, ", table->ids[j]);
+		}
+		printf("\n");
+	}
+}
+
+// just the entities, for bvhs that are built all at once
+Entity *random_entities(Arena *arena, uint32_t entityCount, float maxRadius) {
 	Entity *entities = alloc(arena, entityCount, Entity);
 
-	for (int i = 0; i < entityCount; i++) {
+	for (uint32_t i = 0; i < entityCount; i++) {
 		Vector position = random_vector();
-		float radius = random_float() * 0.3f;
+		float radius = random_float() * maxRadius;
 		
 		AABB ab = { subf(position, radius), addf(position, radius) };
-		uint32_t nodeId = insert_node(bvh, i, ab);
 
 		entities[i] = (Entity){
 			.position = position,
@@ -322,3 +728,22 @@ Entity *create_random_entities(Arena *arena, Bvh *bvh, uint32_t entityCount) {
 
 	return entities;
 }
+
+Entity *create_random_entities_with_radius(Arena *arena, Bvh *bvh, uint32_t entityCount, float maxRadius) {
+	Entity *entities = random_entities(arena, entityCount, maxRadius);
+
+	for (uint32_t i = 0; i < entityCount; i++) {
+		insert_node(bvh, i, entities[i].ab);
+	}
+
+	return entities;
+}
+
+Entity *create_random_entities(Arena *arena, Bvh *bvh, uint32_t entityCount) {
+	return create_random_entities_with_radius(arena, bvh, entityCount, 0.3f);
+}
+
+// keeps the number of neighbours about the same as with 32 entities of radius 0.3, so scenes of any size are comparable
+float radius_for_density(uint32_t entityCount) {
+	return 0.3f * cbrtf(32.0f / (float)entityCount);
+}
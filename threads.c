@@ -0,0 +1,111 @@
+// a very small threading layer, just enough to run one function on n threads and wait for all of them
+// include after arenas.c, every thread gives its scratch arenas back before it exits
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#define MAX_THREADS 256
+
+// threadIndex goes from 0 to threadCount - 1, the calling thread is always 0
+typedef void ThreadProc(void *data, uint32_t threadIndex);
+
+typedef struct ThreadStart {
+	ThreadProc *proc;
+	void *data;
+	uint32_t threadIndex;
+} ThreadStart;
+
+uint32_t hardware_thread_count(void) {
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (uint32_t)info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (uint32_t)count : 1;
+#endif
+}
+
+#if defined(_WIN32)
+DWORD WINAPI thread_entry(LPVOID param) {
+	ThreadStart *start = (ThreadStart*)param;
+	start->proc(start->data, start->threadIndex);
+	scratch_release();
+	return 0;
+}
+#else
+void* thread_entry(void *param) {
+	ThreadStart *start = (ThreadStart*)param;
+	start->proc(start->data, start->threadIndex);
+	scratch_release();
+	return NULL;
+}
+#endif
+
+// threads are started for every call, for work that takes milliseconds or more that doesnt matter
+// the calling thread does its share of the work instead of just waiting
+void run_on_threads(uint32_t threadCount, ThreadProc *proc, void *data) {
+	assert(threadCount >= 1 && threadCount <= MAX_THREADS);
+
+	ThreadStart starts[MAX_THREADS];
+#if defined(_WIN32)
+	HANDLE handles[MAX_THREADS];
+#else
+	pthread_t handles[MAX_THREADS];
+#endif
+
+	for (uint32_t i = 1; i < threadCount; i++) {
+		starts[i] = (ThreadStart){ .proc = proc, .data = data, .threadIndex = i };
+#if defined(_WIN32)
+		handles[i] = CreateThread(NULL, 0, thread_entry, starts + i, 0, NULL);
+		assert(handles[i] != NULL);
+#else
+		int result = pthread_create(handles + i, NULL, thread_entry, starts + i);
+		assert(result == 0);
+#endif
+	}
+
+	proc(data, 0);
+
+	for (uint32_t i = 1; i < threadCount; i++) {
+#if defined(_WIN32)
+		WaitForSingleObject(handles[i], INFINITE);
+		CloseHandle(handles[i]);
+#else
+		pthread_join(handles[i], NULL);
+#endif
+	}
+}
+
+void thread_yield(void) {
+#if defined(_WIN32)
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+// lets a job run in phases without starting new threads for every phase
+// nobody leaves barrier_wait before all threadCount threads have entered it
+// waiting threads yield, so this also works with more threads than cores
+typedef struct Barrier {
+	uint32_t threadCount;
+	uint32_t waiting;
+	uint32_t generation;
+} Barrier;
+
+void barrier_wait(Barrier *barrier) {
+	uint32_t generation = __atomic_load_n(&barrier->generation, __ATOMIC_ACQUIRE);
+	if (__atomic_add_fetch(&barrier->waiting, 1, __ATOMIC_ACQ_REL) == barrier->threadCount) {
+		__atomic_store_n(&barrier->waiting, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&barrier->generation, generation + 1, __ATOMIC_RELEASE);
+		return;
+	}
+
+	while (__atomic_load_n(&barrier->generation, __ATOMIC_ACQUIRE) == generation) {
+		thread_yield();
+	}
+}